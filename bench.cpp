@@ -0,0 +1,616 @@
+#include "chatroom.hpp"
+#include "encryption.hpp"
+#include "logger.hpp"
+#include "rate_limiter.hpp"
+#include "metrics.hpp"
+#include "shm_ring.hpp"
+#include "content_filter.hpp"
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// Microbenchmarks for the core server components.
+//
+// Usage: benchApp [--out <file>] [--filter <substring>]
+//
+// Every benchmark is run as a number of timed samples; the per-operation
+// cost of each sample is recorded and summarised. Results are printed as a
+// single JSON document so two runs can be diffed to catch regressions.
+
+// Keep the compiler from optimizing away the value under test
+template<typename T>
+inline void doNotOptimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult {
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> params;
+    size_t iterations = 0;
+    double nsPerOpMin = 0;
+    double nsPerOpMedian = 0;
+    double nsPerOpMean = 0;
+    double nsPerOpMax = 0;
+    double opsPerSec = 0;
+    double gbPerSec = 0;   // only for benchmarks that process a known number of bytes
+};
+
+class BenchRunner {
+public:
+    explicit BenchRunner(std::string filter) : filter(std::move(filter)) {}
+
+    bool enabled(const std::string& name) const {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // Run `op` for `samples` x `iterationsPerSample` iterations. `op` receives
+    // the number of iterations to perform and returns nothing. With
+    // bytesPerOp set, throughput is also reported in GB/s.
+    template<typename F>
+    void run(const std::string& name,
+             std::vector<std::pair<std::string, std::string>> params,
+             size_t iterationsPerSample, F&& op, size_t samples = 15, size_t bytesPerOp = 0) {
+        if (!enabled(name)) return;
+
+        // Warm up caches and branch predictors
+        op(iterationsPerSample / 4 + 1);
+
+        std::vector<double> perOp;
+        perOp.reserve(samples);
+        for (size_t s = 0; s < samples; ++s) {
+            auto start = std::chrono::steady_clock::now();
+            op(iterationsPerSample);
+            auto end = std::chrono::steady_clock::now();
+            double ns = std::chrono::duration<double, std::nano>(end - start).count();
+            perOp.push_back(ns / iterationsPerSample);
+        }
+
+        std::vector<double> sorted = perOp;
+        std::sort(sorted.begin(), sorted.end());
+
+        BenchResult result;
+        result.name = name;
+        result.params = std::move(params);
+        result.iterations = iterationsPerSample * samples;
+        result.nsPerOpMin = sorted.front();
+        result.nsPerOpMedian = sorted[sorted.size() / 2];
+        result.nsPerOpMean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+        result.nsPerOpMax = sorted.back();
+        result.opsPerSec = result.nsPerOpMedian > 0 ? 1e9 / result.nsPerOpMedian : 0;
+        result.gbPerSec = result.nsPerOpMedian > 0 ? bytesPerOp / result.nsPerOpMedian : 0;
+
+        std::cerr << name;
+        for (const auto& p : result.params) std::cerr << " " << p.first << "=" << p.second;
+        std::cerr << ": " << result.nsPerOpMedian << " ns/op";
+        if (bytesPerOp) std::cerr << ", " << result.gbPerSec << " GB/s";
+        std::cerr << std::endl;
+
+        results.push_back(std::move(result));
+    }
+
+    std::string toJson() const {
+        std::stringstream ss;
+        ss << "{\n  \"schema\": 1,\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& r = results[i];
+            ss << "    {\"name\": \"" << r.name << "\", \"params\": {";
+            for (size_t p = 0; p < r.params.size(); ++p) {
+                if (p) ss << ", ";
+                ss << "\"" << r.params[p].first << "\": \"" << r.params[p].second << "\"";
+            }
+            ss << "}, \"iterations\": " << r.iterations
+               << ", \"ns_per_op_min\": " << r.nsPerOpMin
+               << ", \"ns_per_op_median\": " << r.nsPerOpMedian
+               << ", \"ns_per_op_mean\": " << r.nsPerOpMean
+               << ", \"ns_per_op_max\": " << r.nsPerOpMax
+               << ", \"ops_per_sec\": " << r.opsPerSec;
+            if (r.gbPerSec > 0) ss << ", \"gb_per_sec\": " << r.gbPerSec;
+            ss << "}"
+               << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        ss << "  ]\n}\n";
+        return ss.str();
+    }
+
+private:
+    std::string filter;
+    std::vector<BenchResult> results;
+};
+
+// Participant that only counts what it is given, so Room::deliver is
+// measured without any socket I/O
+class MockParticipant : public Participant {
+public:
+    void deliver(Message& message) override { write(message); }
+    void write(Message& message) override {
+        received++;
+        doNotOptimize(message.getBodyLength());
+    }
+    // Like Session, a batch is handed on as one frame
+    void writeBatch(RoomBatch& batch) override {
+        received += batch.messages.size();
+        doNotOptimize(batch.frame.size());
+    }
+    size_t received = 0;
+};
+
+// Discards everything written to it; used to silence Logger's console output
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+static void benchMessage(BenchRunner& runner) {
+    Message message(std::string(128, 'x'));
+
+    runner.run("message_encode_header", {{"body_bytes", "128"}}, 200000, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            message.encodeHeader();
+            doNotOptimize(message);
+        }
+    });
+
+    runner.run("message_decode_header", {{"body_bytes", "128"}}, 200000, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            bool ok = message.decodeHeader();
+            doNotOptimize(ok);
+        }
+    });
+
+    for (size_t bytes : {size_t(16), size_t(128), static_cast<size_t>(Message::maxBytes)}) {
+        Message sized(std::string(bytes, 'x'));
+        runner.run("message_get_body", {{"body_bytes", std::to_string(bytes)}}, 100000, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                std::string body = sized.getBody();
+                doNotOptimize(body.data());
+            }
+        });
+    }
+}
+
+static void benchEncryption(BenchRunner& runner) {
+    if (!runner.enabled("encryption")) return;
+    Encryption::initialize("BenchmarkKey123");
+
+    for (size_t bytes : {size_t(64), size_t(512)}) {
+        std::string plaintext(bytes, 'p');
+        std::string ciphertext = Encryption::encrypt(plaintext);
+
+        runner.run("encryption_encrypt", {{"bytes", std::to_string(bytes)}}, 20000, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                std::string out = Encryption::encrypt(plaintext);
+                doNotOptimize(out.data());
+            }
+        });
+
+        runner.run("encryption_decrypt", {{"bytes", std::to_string(bytes)}}, 20000, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                std::string out = Encryption::decrypt(ciphertext);
+                doNotOptimize(out.data());
+            }
+        });
+    }
+}
+
+static void benchRateLimiter(BenchRunner& runner) {
+    // Refill fast enough that every call takes the "allowed" path
+    RateLimiter::getInstance().setRateLimit(1e12);
+
+    for (int threads : {1, 2, 4, 8}) {
+        // Each thread performs n checks against its own client id; all of
+        // them serialize on the limiter's single mutex
+        runner.run("rate_limiter_check_limit", {{"threads", std::to_string(threads)}}, 50000, [&](size_t n) {
+            std::vector<std::thread> workers;
+            size_t perThread = n / threads + 1;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([t, perThread]() {
+                    std::string clientId = "bench-client-" + std::to_string(t);
+                    for (size_t i = 0; i < perThread; ++i) {
+                        bool ok = RateLimiter::getInstance().checkLimit(clientId);
+                        doNotOptimize(ok);
+                    }
+                });
+            }
+            for (auto& w : workers) w.join();
+        });
+    }
+}
+
+static void benchMetrics(BenchRunner& runner) {
+    auto& metrics = MetricsCollector::getInstance();
+    std::string clientId = "bench-client";
+
+    runner.run("metrics_start_end_timer", {}, 100000, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            metrics.startTimer("bench_op", clientId);
+            metrics.endTimer("bench_op", clientId);
+        }
+        // Recorded samples grow without bound; keep the footprint flat
+        metrics.clearMetrics();
+    });
+}
+
+static void benchLogger(BenchRunner& runner) {
+    if (!runner.enabled("logger")) return;
+    auto& logger = Logger::getInstance();
+
+    NullBuffer nullBuffer;
+    std::streambuf* original = std::cout.rdbuf(&nullBuffer);
+    logger.setLogFile("bench_logger.log", true);
+
+    logger.setLogLevel(WARNING);
+    runner.run("logger_log", {{"emitted", "false"}}, 200000, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            logger.log(INFO, "Message from %s: %s", "bench-client", "hello world");
+        }
+    });
+
+    logger.setLogLevel(INFO);
+    runner.run("logger_log", {{"emitted", "true"}}, 20000, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            logger.log(INFO, "Message from %s: %s", "bench-client", "hello world");
+        }
+    });
+
+    std::cout.rdbuf(original);
+    std::remove("bench_logger.log");
+}
+
+static void benchRoom(BenchRunner& runner) {
+    if (!runner.enabled("room_deliver_fanout")) return;
+
+    for (size_t members : {size_t(10), size_t(100), size_t(1000)}) {
+        Room room;
+        std::vector<std::shared_ptr<MockParticipant>> participants;
+        for (size_t i = 0; i < members; ++i) {
+            auto participant = std::make_shared<MockParticipant>();
+            participants.push_back(participant);
+            room.join(participant);
+        }
+        ParticipantPointer sender = participants.front();
+        Message message(std::string(128, 'm'));
+
+        size_t iterations = std::max<size_t>(200, 200000 / members);
+        runner.run("room_deliver_fanout", {{"members", std::to_string(members)}}, iterations, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                room.deliver(sender, message);
+            }
+        });
+    }
+}
+
+// Batched fan-out, flushed by the size cap; the window is never reached
+static void benchRoomBatched(BenchRunner& runner) {
+    if (!runner.enabled("room_deliver_fanout_batched")) return;
+
+    boost::asio::io_context io;
+    for (size_t members : {size_t(10), size_t(100), size_t(1000)}) {
+        Room room;
+        room.setBatching(io.get_executor(), std::chrono::seconds(1), 32);
+        std::vector<std::shared_ptr<MockParticipant>> participants;
+        for (size_t i = 0; i < members; ++i) {
+            auto participant = std::make_shared<MockParticipant>();
+            participants.push_back(participant);
+            room.join(participant);
+        }
+        ParticipantPointer sender = participants.front();
+        Message message(std::string(128, 'm'));
+
+        size_t iterations = std::max<size_t>(200, 200000 / members);
+        runner.run("room_deliver_fanout_batched", {{"members", std::to_string(members)}, {"batch", "32"}},
+                   iterations, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                room.deliver(sender, message);
+            }
+        });
+    }
+}
+
+// 64 KiB of chat lines, either plain ASCII or with multi-byte text mixed in
+static std::string ingestInput(bool utf8) {
+    const std::string ascii = "the quick brown fox jumps over the lazy dog 0123456789 ";
+    const std::string mixed = "gr\xc3\xbc\xc3\x9f dich \xe4\xb8\x96\xe7\x95\x8c \xf0\x9f\x98\x80 plain words ";
+    std::string text;
+    while (text.size() < 65536) {
+        size_t length = 40 + (text.size() * 7) % 160;
+        std::string line;
+        while (line.size() < length) line += utf8 ? mixed : ascii;
+        line.resize(IngestScanner::utf8Prefix(line.data(), line.size(), length));
+        text += line + "\n";
+    }
+    text.resize(text.rfind('\n', 65535) + 1);
+    return text;
+}
+
+static void benchIngest(BenchRunner& runner) {
+    if (!runner.enabled("ingest")) return;
+
+    for (bool utf8 : {false, true}) {
+        std::string text = ingestInput(utf8);
+        const char* content = utf8 ? "utf8" : "ascii";
+
+        // What Session did before: async_read_until's delimiter search, then a
+        // copy through buffers_begin iterators
+        boost::asio::streambuf streambuf;
+        std::ostream(&streambuf) << text;
+        runner.run("ingest_read_until", {{"text", content}}, 20, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                auto begin = boost::asio::buffers_begin(streambuf.data());
+                auto end = boost::asio::buffers_end(streambuf.data());
+                while (begin != end) {
+                    auto newline = std::find(begin, end, '\n');
+                    std::string line(begin, newline);
+                    doNotOptimize(line.size());
+                    begin = newline + 1;
+                }
+            }
+        }, 15, text.size());
+
+        std::vector<IngestScanner::Kernel> kernels = {IngestScanner::SCALAR};
+        if (IngestScanner::bestKernel() >= IngestScanner::SSE2) kernels.push_back(IngestScanner::SSE2);
+        if (IngestScanner::bestKernel() >= IngestScanner::AVX2) kernels.push_back(IngestScanner::AVX2);
+        for (auto kernel : kernels) {
+            runner.run("ingest_scan", {{"text", content}, {"kernel", IngestScanner::kernelName(kernel)}}, 20,
+                       [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    IngestScanner scanner(kernel);
+                    const char* data = text.data();
+                    size_t remaining = text.size();
+                    size_t newline;
+                    while ((newline = scanner.scan(data, remaining)) != IngestScanner::npos) {
+                        doNotOptimize(scanner.verdict(data, newline));
+                        std::string line(data, newline);
+                        doNotOptimize(line.size());
+                        data += newline + 1;
+                        remaining -= newline + 1;
+                        scanner.reset();
+                    }
+                }
+            }, 15, text.size());
+        }
+    }
+}
+
+static void benchContentFilter(BenchRunner& runner) {
+    if (!runner.enabled("content_filter")) return;
+
+    std::mt19937 rng(42);
+    auto randomWord = [&](size_t length) {
+        std::string word;
+        for (size_t i = 0; i < length; ++i) {
+            word.push_back(static_cast<char>('a' + rng() % 26));
+        }
+        return word;
+    };
+
+    for (size_t patterns : {1000, 5000}) {
+        std::vector<PatternMatcher::Rule> rules;
+        for (size_t i = 0; i < patterns; ++i) {
+            // Mostly mask rules, a few of each other kind
+            auto action = i % 10 == 0 ? PatternMatcher::REJECT
+                        : i % 10 == 1 ? PatternMatcher::FLAG : PatternMatcher::MASK;
+            rules.push_back({action, randomWord(5 + rng() % 6)});
+        }
+        PatternMatcher matcher(rules);
+
+        for (size_t size : {64, 512}) {
+            std::string clean;
+            while (clean.size() < size) {
+                clean += randomWord(1 + rng() % 8) + " ";
+            }
+            clean.resize(size);
+            // Same length, one mask rule in the middle
+            std::string masked = clean;
+            const std::string& word = rules[2].pattern;
+            masked.replace(size / 2 - word.size() / 2, word.size(), word);
+
+            std::string count = std::to_string(patterns);
+            std::string bytes = std::to_string(size);
+            runner.run("content_filter_scan", {{"patterns", count}, {"bytes", bytes}}, 10000, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    doNotOptimize(matcher.scan(clean.data(), clean.size()));
+                }
+            }, 15, size);
+
+            std::vector<PatternMatcher::Match> matches;
+            runner.run("content_filter_mask", {{"patterns", count}, {"bytes", bytes}}, 10000, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    matches.clear();
+                    doNotOptimize(matcher.scan(masked.data(), masked.size(), &matches));
+                    doNotOptimize(matches.size());
+                }
+            }, 15, size);
+        }
+    }
+}
+
+
+// Connected stream socket pair over loopback TCP (Nagle disabled)
+static bool tcpLoopbackPair(int fds[2]) {
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener, 1) != 0 ||
+        ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        ::close(listener);
+        return false;
+    }
+    fds[0] = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(fds[0], reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(listener);
+        return false;
+    }
+    fds[1] = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+
+    int one = 1;
+    ::setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ::setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fds[1] >= 0;
+}
+
+static bool readFully(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::read(fd, data, length);
+        if (n <= 0) return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::write(fd, data, length);
+        if (n <= 0) return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Round trip and one-way throughput of fixed size messages over a connected
+// socket pair: loopback TCP versus a Unix domain stream socket
+static void benchSocketTransport(BenchRunner& runner, const std::string& transport, int fds[2]) {
+    const size_t messageBytes = 64;
+    std::vector<char> out(messageBytes, 'x');
+    std::vector<char> in(messageBytes);
+
+    runner.run("transport_roundtrip", {{"transport", transport}, {"bytes", "64"}}, 2000, [&](size_t n) {
+        std::thread echo([&, n]() {
+            std::vector<char> buffer(messageBytes);
+            for (size_t i = 0; i < n; ++i) {
+                readFully(fds[1], buffer.data(), messageBytes);
+                writeFully(fds[1], buffer.data(), messageBytes);
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            writeFully(fds[0], out.data(), messageBytes);
+            readFully(fds[0], in.data(), messageBytes);
+        }
+        echo.join();
+    });
+
+    runner.run("transport_throughput", {{"transport", transport}, {"bytes", "64"}}, 20000, [&](size_t n) {
+        std::thread consumer([&, n]() {
+            std::vector<char> buffer(64 * 1024);
+            size_t remaining = n * messageBytes;
+            while (remaining > 0) {
+                ssize_t got = ::read(fds[1], buffer.data(), std::min(buffer.size(), remaining));
+                if (got <= 0) break;
+                remaining -= got;
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            writeFully(fds[0], out.data(), messageBytes);
+        }
+        consumer.join();
+    });
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+static void benchShmTransport(BenchRunner& runner) {
+    const size_t messageBytes = 64;
+    std::string name = "/bytechat-bench-" + std::to_string(::getpid());
+    auto server = ShmChannel::create(name, 1 << 20);
+    auto client = ShmChannel::open(name);
+    if (!server || !client) {
+        std::cerr << "Skipping shm transport benchmark: cannot create " << name << std::endl;
+        return;
+    }
+    std::vector<char> out(messageBytes, 'x');
+
+    runner.run("transport_roundtrip", {{"transport", "shm"}, {"bytes", "64"}}, 2000, [&](size_t n) {
+        std::thread echo([&, n]() {
+            for (size_t i = 0; i < n; ++i) {
+                while (!server->toServer().tryPop([&](const char* data, uint32_t length) {
+                    while (!server->toClient().tryPush(data, length)) std::this_thread::yield();
+                })) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            while (!client->toServer().tryPush(out.data(), messageBytes)) std::this_thread::yield();
+            while (!client->toClient().tryPop([](const char*, uint32_t) {})) std::this_thread::yield();
+        }
+        echo.join();
+    });
+
+    runner.run("transport_throughput", {{"transport", "shm"}, {"bytes", "64"}}, 20000, [&](size_t n) {
+        std::thread consumer([&, n]() {
+            size_t received = 0;
+            while (received < n) {
+                if (!server->toServer().tryPop([&](const char*, uint32_t) { received++; })) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            while (!client->toServer().tryPush(out.data(), messageBytes)) std::this_thread::yield();
+        }
+        consumer.join();
+    });
+}
+
+static void benchTransports(BenchRunner& runner) {
+    if (!runner.enabled("transport")) return;
+
+    int fds[2];
+    if (tcpLoopbackPair(fds)) {
+        benchSocketTransport(runner, "tcp_loopback", fds);
+    }
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+        benchSocketTransport(runner, "unix", fds);
+    }
+    benchShmTransport(runner);
+}
+
+int main(int argc, char* argv[]) {
+    std::string outPath;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            std::cerr << "Usage: benchApp [--out <file>] [--filter <substring>]\n";
+            return 1;
+        }
+    }
+
+    BenchRunner runner(filter);
+    benchMessage(runner);
+    benchEncryption(runner);
+    benchRateLimiter(runner);
+    benchMetrics(runner);
+    benchLogger(runner);
+    benchRoom(runner);
+    benchRoomBatched(runner);
+    benchIngest(runner);
+    benchContentFilter(runner);
+    benchTransports(runner);
+
+    std::string json = runner.toJson();
+    if (outPath.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream out(outPath, std::ios::trunc);
+        out << json;
+        std::cerr << "Results written to " << outPath << std::endl;
+    }
+    return 0;
+}
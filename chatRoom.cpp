@@ -3,120 +3,469 @@
 #include "logger.hpp"
 #include "rate_limiter.hpp"
 #include "metrics.hpp"
+#include "shm_ring.hpp"
+#include "session_directory.hpp"
+#include "load_shedder.hpp"
+#include "content_filter.hpp"
+#include "traffic_trace.hpp"
+#include "runtime_config.hpp"
+#include "io_backend.hpp"
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
 
+// Checks one incoming message from sender. Returns the notice to send back
+// if it is rejected; otherwise nullptr, with the text to pass on in line.
+static const char* admitInput(const char* data, size_t length, IngestScanner::Verdict verdict,
+                              IngestScanner::ControlPolicy policy, const std::string& sender, std::string& line) {
+    const char* rejection = nullptr;
+    if (verdict == IngestScanner::LINE_INVALID_UTF8) {
+        rejection = "Message rejected: invalid UTF-8\n";
+    } else if (verdict == IngestScanner::LINE_HAS_CONTROLS) {
+        if (policy == IngestScanner::REJECT_CONTROLS) {
+            rejection = "Message rejected: control characters are not allowed\n";
+        } else {
+            line = IngestScanner::stripControls(data, length);
+            MetricsCollector::getInstance().recordMetric("ingest_stripped", 1);
+        }
+    } else {
+        line.assign(data, length);
+    }
+    
+    if (rejection) {
+        LOG_WARNING("Rejected message from %s: %s", sender.c_str(),
+                    verdict == IngestScanner::LINE_INVALID_UTF8 ? "invalid UTF-8" : "control characters");
+        MetricsCollector::getInstance().recordMetric("ingest_rejected", 1);
+    }
+    return rejection;
+}
+
+// Runs the content filter over message text from sender, masking in place
+static PatternMatcher::Action filterContent(std::string& text, const std::string& sender) {
+    PatternMatcher::Action action = ContentFilter::getInstance().apply(text);
+    switch (action) {
+        case PatternMatcher::REJECT:
+            LOG_WARNING("Content filter rejected a message from %s", sender.c_str());
+            MetricsCollector::getInstance().recordMetric("content_rejected", 1);
+            break;
+        case PatternMatcher::MASK:
+            MetricsCollector::getInstance().recordMetric("content_masked", 1);
+            break;
+        case PatternMatcher::FLAG:
+            LOG_WARNING("Content filter flagged a message from %s: %s", sender.c_str(), text.c_str());
+            MetricsCollector::getInstance().recordMetric("content_flagged", 1);
+            break;
+        default:
+            break;
+    }
+    return action;
+}
+
+Room::Room(std::string name): name(std::move(name)) {}
+
 void Room::join(ParticipantPointer participant){
-    this->participants.insert(participant);
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        wasEmpty = participants.empty();
+        this->participants.insert(participant);
+    }
+    if (wasEmpty && relay) {
+        relay->setInterest(name, true);
+    }
 }
 
 void Room::leave(ParticipantPointer participant){
-    this->participants.erase(participant);
+    bool nowEmpty;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        nowEmpty = this->participants.erase(participant) && participants.empty();
+    }
+    if (nowEmpty && relay) {
+        relay->setInterest(name, false);
+    }
+}
+
+void Room::setRelay(RoomRelay* newRelay) {
+    relay = newRelay;
+    if (relay && hasMembers()) {
+        relay->setInterest(name, true);
+    }
 }
 
 void Room::deliver(ParticipantPointer sender, Message &message) {
-    // Deliver current message to all other participants
-    for (auto participant : participants) {
-        if (participant != sender) {
-            participant->write(message);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        deliverLocal(sender, message);
+    }
+    
+    // Forward to other nodes that have members in this room
+    if (relay) {
+        relay->publish(name, message);
+    }
+}
+
+std::vector<ParticipantPointer> Room::getParticipants() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return std::vector<ParticipantPointer>(participants.begin(), participants.end());
+}
+
+std::vector<std::string> Room::getHistory() {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::vector<std::string> bodies;
+    for (auto& message : messageQueue) {
+        bodies.push_back(message.getBody());
+    }
+    return bodies;
+}
+
+void Room::restoreHistory(const std::vector<std::string>& bodies) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto& body : bodies) {
+        messageQueue.push_back(Message(body));
+    }
+    // The previous process may have kept more than this one is configured for
+    size_t historySize = RuntimeConfig::current().historySize;
+    while (messageQueue.size() > historySize) {
+        messageQueue.pop_front();
+    }
+}
+
+void Room::deliverRemote(Message &message) {
+    std::lock_guard<std::mutex> lock(mtx);
+    deliverLocal(nullptr, message);
+}
+
+void Room::deliverLocal(ParticipantPointer sender, Message &message) {
+    if (batchWindow.count() > 0) {
+        enqueueBatch(sender.get(), message);
+    } else {
+        // Deliver current message to all other participants
+        for (auto participant : participants) {
+            if (participant != sender) {
+                participant->write(message);
+            }
         }
     }
     
     // Store in recent messages queue (optional)
     messageQueue.push_back(message);
-    while (messageQueue.size() > 100) {
+    size_t historySize = RuntimeConfig::current().historySize;
+    while (messageQueue.size() > historySize) {
         messageQueue.pop_front();
     }
 }
 
+void Room::setBatching(boost::asio::any_io_executor executor,
+                       std::chrono::microseconds window, size_t maxMessages) {
+    std::lock_guard<std::mutex> lock(mtx);
+    flushLocked();
+    batchWindow = window;
+    maxBatchMessages = std::max<size_t>(1, maxMessages);
+    if (window.count() > 0) {
+        batchTimer = std::make_unique<boost::asio::steady_timer>(executor);
+        LOG_INFO("Room %s batches broadcasts every %lld us (up to %zu messages)",
+                 name.c_str(), static_cast<long long>(window.count()), maxBatchMessages);
+    } else {
+        batchTimer.reset();
+    }
+}
+
+void Room::enqueueBatch(const Participant* sender, Message &message) {
+    pendingBatch.messages.push_back(message);
+    pendingBatch.senders.push_back(sender);
+    pendingBatch.frame += message.getBody();
+    pendingBatch.frame += '\n';
+    pendingArrivals.push_back(std::chrono::steady_clock::now());
+    
+    if (pendingBatch.messages.size() >= maxBatchMessages) {
+        flushLocked();
+        return;
+    }
+    
+    // The first message of a batch starts the tick
+    if (pendingBatch.messages.size() == 1) {
+        batchTimer->expires_after(batchWindow);
+        // cancel() cannot stop a handler that is already queued; one left
+        // over from a batch flushed early must not cut the next one short
+        batchTimer->async_wait([this, generation = batchGeneration](const boost::system::error_code& ec) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!ec && generation == batchGeneration) {
+                flushLocked();
+            }
+        });
+    }
+}
+
+void Room::flush() {
+    std::lock_guard<std::mutex> lock(mtx);
+    flushLocked();
+}
+
+void Room::flushLocked() {
+    if (pendingBatch.messages.empty()) {
+        return;
+    }
+    if (batchTimer) {
+        batchTimer->cancel();
+    }
+    
+    ++batchGeneration;
+    
+    RoomBatch batch;
+    std::swap(batch, pendingBatch);
+    std::vector<std::chrono::steady_clock::time_point> arrivals;
+    std::swap(arrivals, pendingArrivals);
+    
+    auto now = std::chrono::steady_clock::now();
+    auto& metrics = MetricsCollector::getInstance();
+    metrics.recordMetric("room_batch_size", batch.messages.size());
+    for (const auto& arrived : arrivals) {
+        metrics.recordMetric("room_batch_added_latency",
+            std::chrono::duration_cast<std::chrono::microseconds>(now - arrived).count());
+    }
+    
+    for (auto participant : participants) {
+        participant->writeBatch(batch);
+    }
+}
+
 void Session::async_read() {
+    // Complete lines already buffered (handed over, or read while paused) come first
+    auto started = std::chrono::steady_clock::now();
+    bool carryOn = processInput();
+    accounting.counters->add(SessionCounters::PROCESSING_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count());
+    if (!carryOn || paused) {
+        return;
+    }
+    
     auto self(shared_from_this());
-    boost::asio::async_read_until(clientSocket, buffer, "\n",
-        [this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
-            if (!ec) {
-                // Start timing
-                MetricsCollector::getInstance().startTimer("message_processing", clientId);
-                
-                std::string data(boost::asio::buffers_begin(buffer.data()), 
-                                boost::asio::buffers_begin(buffer.data()) + bytes_transferred);
-                buffer.consume(bytes_transferred);
-                
-                // Remove newline
-                if (!data.empty() && data.back() == '\n') {
-                    data.pop_back();
-                }
-                
-                // Check for special commands
-                if (data == "!metrics") {
-                    // Generate metrics report
-                    std::string report = MetricsCollector::getInstance().generateReport();
-                    
-                    // Send report to client
-                    std::string response = "=== METRICS REPORT ===\n" + report + "\n";
-                    boost::asio::async_write(clientSocket, 
-                        boost::asio::buffer(response),
-                        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                            if (ec) {
-                                LOG_ERROR("Error sending metrics to client %s: %s", 
-                                          clientId.c_str(), ec.message().c_str());
-                            }
-                        });
-                    
-                    // Continue reading
-                    async_read();
-                    return;
-                }
-                
-                LOG_DEBUG("Received raw data from %s: %s", clientId.c_str(), data.c_str());
-                
-                // Check rate limit
-                if (!RateLimiter::getInstance().checkLimit(clientId)) {
-                    LOG_WARNING("Rate limit exceeded for client %s", clientId.c_str());
-                    std::string error_msg = "Rate limit exceeded. Please wait before sending more messages.\n";
-                    boost::asio::async_write(clientSocket, boost::asio::buffer(error_msg),
-                        [](boost::system::error_code, std::size_t) {});
-                    
-                    // Continue reading
-                    async_read();
-                    return;
+    size_t space = std::min(buffer.max_size() - buffer.size(), static_cast<size_t>(readChunk));
+    readPending = true;
+    if (ring) {
+        // The ring picks a buffer of its own; the bytes are copied into ours
+        readOp = ring->receive(clientSocket.native_handle(), space,
+            [this, self](int result, const char* data, bool) {
+                readOp = 0;
+                size_t bytes = result > 0 ? static_cast<size_t>(result) : 0;
+                if (bytes > 0) {
+                    boost::asio::buffer_copy(buffer.prepare(bytes), boost::asio::buffer(data, bytes));
                 }
-                
-                // Create message
-                Message message(data);
-                
-                // Log and deliver message
-                std::string msgBody = message.getBody();
-                LOG_INFO("Message from %s: %s", clientId.c_str(), msgBody.c_str());
-                
-                // End timing
-                MetricsCollector::getInstance().endTimer("message_processing", clientId);
-                
-                // Start delivery timing
-                MetricsCollector::getInstance().startTimer("message_delivery", clientId);
-                
-                // Deliver to room
-                room.deliver(shared_from_this(), message);
-                
-                // End delivery timing
-                MetricsCollector::getInstance().endTimer("message_delivery", clientId);
-                
-                // Continue reading
-                async_read();
-            } else {
-                room.leave(shared_from_this());
-                if (ec == boost::asio::error::eof) {
-                    LOG_INFO("Connection closed by client: %s", clientId.c_str());
-                } else {
-                    LOG_ERROR("Read error for client %s: %s", 
-                              clientId.c_str(), ec.message().c_str());
-                }
-            }
+                readDone(result == 0 ? boost::asio::error::eof : UringLoop::errorCode(result), bytes);
+            });
+        return;
+    }
+    clientSocket.async_read_some(buffer.prepare(space),
+        [this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
+            readDone(ec, bytes_transferred);
         }
     );
 }
 
+void Session::readDone(const boost::system::error_code& ec, size_t bytes_transferred) {
+    readPending = false;
+    buffer.commit(bytes_transferred);
+    accountInput();
+    accounting.counters->add(SessionCounters::BYTES_IN, bytes_transferred);
+    
+    // Paused for a hot restart: unprocessed input stays in the buffer and is handed over
+    if (paused) {
+        return;
+    }
+    // Read cancelled by a handover that was then aborted, or by stop()
+    if (ec == boost::asio::error::operation_aborted) {
+        if (!stopped) {
+            async_read();
+        }
+        return;
+    }
+    if (!ec) {
+        async_read();
+        return;
+    }
+    
+    stop();
+    if (ec == boost::asio::error::eof) {
+        LOG_INFO("Connection closed by client: %s", clientId.c_str());
+    } else {
+        LOG_ERROR("Read error for client %s: %s", 
+                  clientId.c_str(), ec.message().c_str());
+    }
+}
+
+bool Session::processInput() {
+    if (profile->framing == SessionProfile::BINARY) {
+        if (!extractFrames()) {
+            return false;
+        }
+    } else {
+        extractLines();
+    }
+    
+    // A partial line filling the whole input budget will never fit
+    if (buffer.size() >= buffer.max_size()) {
+        LOG_WARNING("Disconnecting %s: line exceeds the %zu byte input budget",
+                    clientId.c_str(), buffer.max_size());
+        MetricsCollector::getInstance().recordMetric("memory_budget_disconnects", 1);
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Session::extractLines() {
+    // One pass over the new bytes finds the line end and validates the line
+    for (;;) {
+        const char* data = static_cast<const char*>(buffer.data().data());
+        size_t newline = scanner.scan(data, buffer.size());
+        if (newline == IngestScanner::npos) {
+            break;
+        }
+        
+        IngestScanner::Verdict verdict = scanner.verdict(data, newline);
+        size_t length = newline;
+        if (length > 0 && data[length - 1] == '\r') {
+            length--;
+        }
+        
+        std::string line;
+        const char* rejection = admitInput(data, length, verdict, controlPolicy, clientId, line);
+        buffer.consume(newline + 1);
+        scanner.reset();
+        TrafficCapture::getInstance().message(traceId, newline + 1);
+        accounting.counters->add(SessionCounters::MESSAGES_IN, 1);
+        
+        if (rejection) {
+            notify(rejection);
+        } else {
+            handleLine(std::move(line));
+        }
+    }
+}
+
+bool Session::extractFrames() {
+    auto& metrics = MetricsCollector::getInstance();
+    
+    for (;;) {
+        const char* data = static_cast<const char*>(buffer.data().data());
+        if (buffer.size() < Message::header) {
+            return true;
+        }
+        
+        // Header as written by Message::encodeHeader: a space-padded decimal length
+        size_t length = 0;
+        bool digits = false;
+        bool valid = true;
+        for (size_t i = 0; i < Message::header && valid; ++i) {
+            if (data[i] >= '0' && data[i] <= '9') {
+                length = length * 10 + (data[i] - '0');
+                digits = true;
+            } else if (data[i] != ' ' || digits) {
+                valid = false;
+            }
+        }
+        // There is no way to find the next frame after a bad header
+        if (!valid || !digits || length > Message::maxBytes) {
+            LOG_WARNING("Disconnecting %s: malformed frame header", clientId.c_str());
+            metrics.recordMetric("ingest_rejected", 1);
+            stop();
+            return false;
+        }
+        if (buffer.size() < Message::header + length) {
+            return true;
+        }
+        
+        const char* body = data + Message::header;
+        IngestScanner::Verdict verdict = IngestScanner::classify(body, length);
+        std::string line;
+        const char* rejection = admitInput(body, length, verdict, controlPolicy, clientId, line);
+        buffer.consume(Message::header + length);
+        TrafficCapture::getInstance().message(traceId, Message::header + length);
+        accounting.counters->add(SessionCounters::MESSAGES_IN, 1);
+        
+        if (rejection) {
+            notify(rejection);
+        } else {
+            handleLine(std::move(line));
+        }
+    }
+}
+
+void Session::handleLine(std::string data) {
+    // Start timing
+    MetricsCollector::getInstance().startTimer("message_processing", clientId);
+    
+    // Check for special commands
+    if (data == "!metrics") {
+        MetricsCollector::getInstance().cancelTimer("message_processing", clientId);
+        
+        // Reports are low priority and the first thing shed under overload
+        if (LoadShedder::getInstance().shedLowPriority()) {
+            MetricsCollector::getInstance().recordMetric("dropped_low_priority", 1);
+            notify("Server overloaded, metrics unavailable\n");
+            return;
+        }
+        
+        // Generate metrics report
+        std::string report = MetricsCollector::getInstance().generateReport();
+        
+        // Send report to client, with this session's own footprint
+        const SessionCounters& counters = *accounting.counters;
+        notify("=== METRICS REPORT ===\n" + report +
+                    "  this session: " + std::to_string(accountedInput) + " bytes input, " +
+                    std::to_string(outputBytes) + " bytes output buffered; " +
+                    std::to_string(counters.get(SessionCounters::BYTES_IN)) + " bytes / " +
+                    std::to_string(counters.get(SessionCounters::MESSAGES_IN)) + " messages in, " +
+                    std::to_string(counters.get(SessionCounters::BYTES_OUT)) + " bytes / " +
+                    std::to_string(counters.get(SessionCounters::MESSAGES_OUT)) + " messages out, " +
+                    std::to_string(counters.get(SessionCounters::PROCESSING_NS) / 1000) + " us processing, " +
+                    std::to_string(counters.get(SessionCounters::QUEUE_NS) / 1000) + " us queued\n\n");
+        return;
+    }
+    
+    LOG_DEBUG("Received raw data from %s: %s", clientId.c_str(), data.c_str());
+    
+    // Check rate limit
+    if (!RateLimiter::getInstance().checkLimit(clientId, profile->rateLimit, profile->burst)) {
+        LOG_WARNING("Rate limit exceeded for client %s", clientId.c_str());
+        MetricsCollector::getInstance().cancelTimer("message_processing", clientId);
+        notify("Rate limit exceeded. Please wait before sending more messages.\n");
+        return;
+    }
+    
+    if (handleCommand(data)) {
+        MetricsCollector::getInstance().endTimer("message_processing", clientId);
+        return;
+    }
+    
+    if (!filterText(data)) {
+        MetricsCollector::getInstance().cancelTimer("message_processing", clientId);
+        return;
+    }
+    
+    // Create message; an over-long body is cut at a character boundary
+    data.resize(IngestScanner::utf8Prefix(data.data(), data.size(), RuntimeConfig::current().maxMessageBytes));
+    Message message(data);
+    
+    // Log and deliver message
+    std::string msgBody = message.getBody();
+    LOG_INFO("Message from %s: %s", clientId.c_str(), msgBody.c_str());
+    
+    // End timing
+    MetricsCollector::getInstance().endTimer("message_processing", clientId);
+    
+    // Start delivery timing
+    MetricsCollector::getInstance().startTimer("message_delivery", clientId);
+    
+    // Deliver to room
+    room.deliver(shared_from_this(), message);
+    
+    // End delivery timing
+    MetricsCollector::getInstance().endTimer("message_delivery", clientId);
+}
+
 void Session::async_write(std::string messageBody, size_t messageLength) {
     auto self(shared_from_this());
     boost::asio::async_write(clientSocket, 
@@ -130,9 +479,87 @@ void Session::async_write(std::string messageBody, size_t messageLength) {
         });
 }
 
+bool Session::filterText(std::string& text) {
+    if (filterContent(text, clientId) == PatternMatcher::REJECT) {
+        notify("Message rejected by content filter\n");
+        return false;
+    }
+    return true;
+}
+
+bool Session::handleCommand(const std::string& data) {
+    auto& directory = SessionDirectory::getInstance();
+    
+    // /msg <clientId|nick> <text>: deliver to one participant only
+    if (data.rfind("/msg ", 0) == 0) {
+        size_t targetEnd = data.find(' ', 5);
+        if (targetEnd == std::string::npos || targetEnd == 5) {
+            notify("Usage: /msg <client id or nick> <message>\n");
+            return true;
+        }
+        std::string target = data.substr(5, targetEnd - 5);
+        ParticipantPointer recipient = directory.resolve(target);
+        if (!recipient) {
+            notify("No such user: " + target + "\n");
+            return true;
+        }
+        
+        std::string text = data.substr(targetEnd + 1);
+        if (!filterText(text)) {
+            return true;
+        }
+        // Cut at a character boundary like room messages, header included
+        text = "[DM from " + (nick.empty() ? clientId : nick) + "] " + text;
+        text.resize(IngestScanner::utf8Prefix(text.data(), text.size(), RuntimeConfig::current().maxMessageBytes));
+        Message message(text);
+        LOG_INFO("Direct message from %s to %s", clientId.c_str(), target.c_str());
+        MetricsCollector::getInstance().recordMetric("direct_messages", 1);
+        recipient->write(message);
+        return true;
+    }
+    
+    // /nick <name>: claim a nickname others can address with /msg
+    if (data.rfind("/nick ", 0) == 0) {
+        std::string newNick = data.substr(6);
+        if (newNick.empty() || newNick.find(' ') != std::string::npos) {
+            notify("Usage: /nick <name>\n");
+            return true;
+        }
+        if (!directory.claimNick(newNick, shared_from_this())) {
+            notify("Nickname already in use: " + newNick + "\n");
+            return true;
+        }
+        if (!nick.empty() && nick != newNick) {
+            directory.releaseNick(nick, this);
+        }
+        nick = newNick;
+        SessionAccounting::getInstance().relabel(accounting, accountingLabel());
+        LOG_INFO("Client %s is now known as %s", clientId.c_str(), nick.c_str());
+        notify("You are now known as " + nick + "\n");
+        return true;
+    }
+    
+    return false;
+}
+
 void Session::start() {
+    // Accepted or restored elsewhere; everything from here on runs on the session's own thread
+    if (!inSessionThread()) {
+        auto self(shared_from_this());
+        boost::asio::post(clientSocket.get_executor(), [self]() { self->start(); });
+        return;
+    }
+    
+    auto& directory = SessionDirectory::getInstance();
+    directory.add(clientId, shared_from_this());
+    if (!nick.empty() && !directory.claimNick(nick, shared_from_this())) {
+        nick.clear();
+    }
+    
     room.join(shared_from_this());
     async_read();
+    // Output handed over by the previous process goes out right away
+    do_write();
     
     // Start heartbeat timer
     start_heartbeat_timer();
@@ -141,170 +568,584 @@ void Session::start() {
 void Session::start_heartbeat_timer() {
     auto self(shared_from_this());
     heartbeat_timer = std::make_unique<boost::asio::steady_timer>(clientSocket.get_executor());
-    heartbeat_timer->expires_after(std::chrono::seconds(30)); // Send heartbeat every 30 seconds
+    // A changed interval applies from the next heartbeat; while heartbeats
+    // are off, check back every second in case they are turned on
+    auto interval = RuntimeConfig::current().heartbeat;
+    heartbeat_timer->expires_after(interval.count() > 0 ? interval : std::chrono::seconds(1));
     
     heartbeat_timer->async_wait(
-        [this, self](const boost::system::error_code& ec) {
+        [this, self, interval](const boost::system::error_code& ec) {
             if (!ec) {
-                // Send ping message
-                std::string ping = "PING\n";
-                boost::asio::async_write(clientSocket, 
-                    boost::asio::buffer(ping),
-                    [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                        if (!ec) {
-                            // Schedule next heartbeat
-                            start_heartbeat_timer();
-                        }
-                    });
+                // Send ping message and schedule next heartbeat; skipped while shedding load
+                if (interval.count() > 0 && LoadShedder::getInstance().shedLowPriority()) {
+                    MetricsCollector::getInstance().recordMetric("dropped_low_priority", 1);
+                } else if (interval.count() > 0) {
+                    notify("PING\n");
+                }
+                start_heartbeat_timer();
             }
         });
 }
 
-Session::Session(tcp::socket s, Room& r): 
+Session::Session(Socket s, Room& r, SessionProfilePointer p): 
     clientSocket(std::move(s)), 
-    room(r) {
+    profile(std::move(p)),
+    buffer(MemoryAccounting::getInstance().getBudgets().sessionInputBytes),
+    room(r),
+    traceId(TrafficCapture::getInstance().connect()) {
+    ring = IoBackend::ringFor(clientSocket.get_executor());
+    
     // Generate unique client ID
     boost::uuids::uuid uuid = boost::uuids::random_generator()();
     clientId = boost::lexical_cast<std::string>(uuid);
-    
-    // Enable TCP keepalive
-    boost::asio::socket_base::keep_alive option(true);
-    clientSocket.set_option(option);
+    accounting = SessionAccounting::getInstance().acquire(clientId);
     
     // Log new connection
-    auto endpoint = clientSocket.remote_endpoint();
-    LOG_INFO("Client connected: %s (IP: %s, Port: %d)", 
-             clientId.c_str(),
-             endpoint.address().to_string().c_str(),
-             endpoint.port());
+    auto peer = clientSocket.remote_endpoint();
+    if (peer.protocol().family() == AF_INET || peer.protocol().family() == AF_INET6) {
+        // Enable TCP keepalive
+        boost::asio::socket_base::keep_alive option(true);
+        clientSocket.set_option(option);
+        
+        tcp::endpoint endpoint;
+        std::memcpy(endpoint.data(), peer.data(), peer.size());
+        LOG_INFO("Client connected: %s (IP: %s, Port: %d)", 
+                 clientId.c_str(),
+                 endpoint.address().to_string().c_str(),
+                 endpoint.port());
+    } else {
+        LOG_INFO("Client connected: %s (local socket)", clientId.c_str());
+    }
     
     // Initialize metrics
     MetricsCollector::getInstance().recordMetric("active_connections", 1);
+    MemoryAccounting::getInstance().addSessions(1);
+}
+
+Session::Session(Socket s, Room& r, const SessionState& state, SessionProfilePointer p): 
+    clientSocket(std::move(s)), 
+    profile(std::move(p)),
+    buffer(MemoryAccounting::getInstance().getBudgets().sessionInputBytes),
+    room(r),
+    clientId(state.clientId),
+    nick(state.nick),
+    traceId(TrafficCapture::getInstance().connect()) {
+    ring = IoBackend::ringFor(clientSocket.get_executor());
+    
+    // Input that the previous process had read but not yet processed
+    std::ostream input(&buffer);
+    input << state.pendingInput;
+    accountInput();
+    
+    accounting = SessionAccounting::getInstance().acquire(accountingLabel());
+    messageQueue.assign(state.pendingOutput.begin(), state.pendingOutput.end());
+    queuedAt.assign(messageQueue.size(), std::chrono::steady_clock::now());
+    LoadShedder::getInstance().addQueued(messageQueue.size());
+    for (const auto& output : messageQueue) {
+        outputBytes += output.size();
+    }
+    MemoryAccounting::getInstance().add(MemoryAccounting::SESSION_OUTPUT, outputBytes);
+    
+    LOG_INFO("Client resumed: %s", clientId.c_str());
+    MetricsCollector::getInstance().recordMetric("active_connections", 1);
+    MemoryAccounting::getInstance().addSessions(1);
 }
 
 Session::~Session() {
+    LoadShedder::getInstance().addQueued(-static_cast<long>(messageQueue.size()));
+    
+    auto& accounting = MemoryAccounting::getInstance();
+    accounting.add(MemoryAccounting::SESSION_INPUT, -static_cast<long>(accountedInput));
+    accounting.add(MemoryAccounting::SESSION_OUTPUT, -static_cast<long>(outputBytes));
+    accounting.addSessions(-1);
+    TrafficCapture::getInstance().disconnect(traceId);
+    SessionAccounting::getInstance().release(this->accounting);
+    
+    // Per-client state elsewhere would otherwise outlive the session
+    RateLimiter::getInstance().removeClient(clientId);
+    auto& metrics = MetricsCollector::getInstance();
+    metrics.cancelTimer("message_processing", clientId);
+    metrics.cancelTimer("message_delivery", clientId);
+    metrics.cancelTimer("message_write", clientId);
+    
+    auto& directory = SessionDirectory::getInstance();
+    directory.remove(clientId, this);
+    if (!nick.empty()) {
+        directory.releaseNick(nick, this);
+    }
+    
+    if (handedOver) {
+        return;
+    }
     LOG_INFO("Client disconnected: %s", clientId.c_str());
     MetricsCollector::getInstance().recordMetric("active_connections", -1);
 }
 
+void Session::pause() {
+    paused = true;
+    if (heartbeat_timer) {
+        heartbeat_timer->cancel();
+    }
+}
+
+void Session::cancelWrite() {
+    // The write handler keeps what was not sent yet queued (see writeDone)
+    if (ring) {
+        ring->cancel(writeOp);
+        return;
+    }
+    boost::system::error_code ec;
+    clientSocket.cancel(ec);
+}
+
+void Session::resume() {
+    paused = false;
+    if (!readPending) {
+        async_read();
+    }
+    start_heartbeat_timer();
+    do_write();
+}
+
+SessionState Session::exportState() {
+    // No write is in flight by now; cancelling only aborts the pending read.
+    // A ring's receive must be over before the descriptor goes: the request
+    // would go on reading from the socket the new process owns.
+    if (ring) {
+        ring->cancelAndWait(readOp);
+    } else {
+        boost::system::error_code ec;
+        clientSocket.cancel(ec);
+    }
+    
+    SessionState state;
+    state.clientId = clientId;
+    state.nick = nick;
+    state.listener = profile->listener;
+    state.pendingInput.assign(boost::asio::buffers_begin(buffer.data()),
+                              boost::asio::buffers_end(buffer.data()));
+    state.pendingOutput.assign(messageQueue.begin(), messageQueue.end());
+    return state;
+}
+
+void Session::finishHandover() {
+    handedOver = true;
+    room.leave(shared_from_this());
+    
+    // The descriptor now lives on in the new process; closing our copy sends no FIN
+    boost::system::error_code ec;
+    clientSocket.close(ec);
+}
+
 void Session::write(Message &message) {
-    // Encrypt the message if needed
-    std::string body = message.getBody();
-    bool write_in_progress = !messageQueue.empty();
-    messageQueue.push_back(message);
+    if (!message.decodeHeader()) {
+        LOG_WARNING("Message length exceeds the max length for client %s", clientId.c_str());
+        return;
+    }
+    if (profile->framing == SessionProfile::BINARY) {
+        queueOutput(message.getData());
+    } else {
+        queueOutput(message.getBody() + "\n"); // Add newline for client detection
+    }
+}
+
+void Session::writeBatch(RoomBatch& batch) {
+    if (profile->framing == SessionProfile::BINARY) {
+        std::string frames;
+        for (size_t i = 0; i < batch.messages.size(); ++i) {
+            if (batch.senders[i] != this) {
+                frames += batch.messages[i].getData();
+            }
+        }
+        if (!frames.empty()) {
+            queueOutput(std::move(frames));
+        }
+        return;
+    }
+    
+    // Usually none of the batch came from this session and the shared frame goes out as is
+    if (std::find(batch.senders.begin(), batch.senders.end(), this) == batch.senders.end()) {
+        queueOutput(batch.frame);
+        return;
+    }
+    
+    std::string frame;
+    for (size_t i = 0; i < batch.messages.size(); ++i) {
+        if (batch.senders[i] != this) {
+            frame += batch.messages[i].getBody();
+            frame += '\n';
+        }
+    }
+    if (!frame.empty()) {
+        queueOutput(std::move(frame));
+    }
+}
+
+void Session::accountInput() {
+    size_t capacity = buffer.capacity();
+    MemoryAccounting::getInstance().add(MemoryAccounting::SESSION_INPUT,
+                                        static_cast<long>(capacity) - static_cast<long>(accountedInput));
+    accountedInput = capacity;
+}
+
+void Session::queueOutput(std::string data) {
+    if (!inSessionThread()) {
+        auto self(shared_from_this());
+        boost::asio::post(clientSocket.get_executor(), [this, self, data = std::move(data)]() mutable {
+            queueOutput(std::move(data));
+        });
+        return;
+    }
     
-    if (!write_in_progress) {
+    // A consumer this far behind is cut off rather than allowed to grow without bound
+    size_t budget = MemoryAccounting::getInstance().getBudgets().sessionOutputBytes;
+    if (outputBytes + data.size() > budget) {
+        if (!overBudget) {
+            overBudget = true;
+            LOG_WARNING("Disconnecting %s: queued output exceeds the %zu byte budget", clientId.c_str(), budget);
+            MetricsCollector::getInstance().recordMetric("memory_budget_disconnects", 1);
+            
+            // Possibly called while the room iterates its members; leave afterwards
+            auto self(shared_from_this());
+            boost::asio::post(clientSocket.get_executor(), [this, self]() {
+                boost::system::error_code ec;
+                clientSocket.close(ec);
+                // Closing does not end a send the ring has pending
+                if (ring) {
+                    ring->cancel(writeOp);
+                }
+                stop();
+            });
+        }
+        return;
+    }
+    
+    outputBytes += data.size();
+    MemoryAccounting::getInstance().add(MemoryAccounting::SESSION_OUTPUT, data.size());
+    messageQueue.push_back(std::move(data));
+    queuedAt.push_back(std::chrono::steady_clock::now());
+    LoadShedder::getInstance().addQueued(1);
+    if (!writing) {
         do_write();
     }
 }
 
+void Session::notify(const std::string& text) {
+    if (profile->framing == SessionProfile::NEWLINE) {
+        queueOutput(text);
+        return;
+    }
+    
+    // One frame per line; lines longer than a frame are split at character boundaries
+    std::string frames;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        const char* line = text.data() + start;
+        size_t length = end - start;
+        do {
+            size_t chunk = IngestScanner::utf8Prefix(line, length, Message::maxBytes);
+            if (chunk == 0) {
+                chunk = std::min<size_t>(length, Message::maxBytes);
+            }
+            frames += Message(std::string(line, chunk)).getData();
+            line += chunk;
+            length -= chunk;
+        } while (length > 0);
+        start = end + 1;
+    }
+    queueOutput(std::move(frames));
+}
+
+bool Session::inSessionThread() {
+    // target() does not check the type in this Boost version; target_type() does
+    auto executor = clientSocket.get_executor();
+    typedef boost::asio::io_context::executor_type LoopExecutor;
+    typedef boost::asio::strand<LoopExecutor> StrandExecutor;
+    if (executor.target_type() == typeid(StrandExecutor)) {
+        return executor.target<StrandExecutor>()->running_in_this_thread();
+    }
+    if (executor.target_type() == typeid(LoopExecutor)) {
+        return executor.target<LoopExecutor>()->running_in_this_thread();
+    }
+    return true;
+}
+
+std::string Session::accountingLabel() const {
+    return nick.empty() ? clientId : nick + " (" + clientId + ")";
+}
+
+SessionProfilePointer Session::defaultProfile() {
+    static const SessionProfilePointer profile = std::make_shared<const SessionProfile>();
+    return profile;
+}
+
 void Session::do_write() {
     auto self(shared_from_this());
     
-    if (messageQueue.empty()) {
+    // While paused for a hot restart, output keeps queueing and is handed over
+    if (messageQueue.empty() || paused) {
         return;
     }
     
-    Message& message = messageQueue.front();
-    bool header_decode = message.decodeHeader();
+    // Start write timing
+    MetricsCollector::getInstance().startTimer("message_write", clientId);
     
-    if (header_decode) {
-        std::string body = message.getBody();
-        body += "\n"; // Add newline for client detection
-        
-        // Start write timing
-        MetricsCollector::getInstance().startTimer("message_write", clientId);
-        
-        boost::asio::async_write(clientSocket, 
-            boost::asio::buffer(body, body.length()),
-            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                // End write timing
-                MetricsCollector::getInstance().endTimer("message_write", clientId);
-                
-                if (!ec) {
-                    messageQueue.pop_front();
-                    if (!messageQueue.empty()) {
-                        do_write();
-                    }
-                } else {
-                    LOG_ERROR("Write error for client %s: %s", 
-                              clientId.c_str(), ec.message().c_str());
-                    room.leave(shared_from_this());
-                }
+    // Gather everything queued so far into one write: under fan-out a busy
+    // session sends many messages per syscall (or per ring submission).
+    // Deque elements keep their address while more output is appended.
+    std::vector<boost::asio::const_buffer> buffers;
+    size_t count = std::min(messageQueue.size(), static_cast<size_t>(maxWriteBatch));
+    buffers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        buffers.push_back(boost::asio::buffer(messageQueue[i]));
+    }
+    MetricsCollector::getInstance().recordMetric("write_batch_size", count);
+    
+    auto now = std::chrono::steady_clock::now();
+    uint64_t queuedNs = 0;
+    for (size_t i = 0; i < count; ++i) {
+        queuedNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - queuedAt.front()).count();
+        queuedAt.pop_front();
+    }
+    accounting.counters->add(SessionCounters::QUEUE_NS, queuedNs);
+    
+    writing = true;
+    if (ring) {
+        // Goes out with the rest of this round's submissions, in one system call
+        writeOp = ring->send(clientSocket.native_handle(), buffers,
+            [this, self, count](int result, const char*, bool) {
+                writeOp = 0;
+                writeDone(UringLoop::errorCode(result), result > 0 ? static_cast<size_t>(result) : 0, count);
             });
-    } else {
-        LOG_WARNING("Message length exceeds the max length for client %s", clientId.c_str());
-        messageQueue.pop_front();
-        if (!messageQueue.empty()) {
+        return;
+    }
+    boost::asio::async_write(clientSocket, buffers,
+        [this, self, count](boost::system::error_code ec, std::size_t length) {
+            writeDone(ec, length, count);
+        });
+}
+
+void Session::writeDone(const boost::system::error_code& ec, size_t length, size_t count) {
+    // End write timing
+    MetricsCollector::getInstance().endTimer("message_write", clientId);
+    writing = false;
+    
+    if (!ec || (paused && ec == boost::asio::error::operation_aborted)) {
+        // A send through the ring may be short, and one cancelled for a hot
+        // restart is handed over (or sent on resume): the rest of the batch
+        // is queued again as of now
+        size_t before = messageQueue.size();
+        consumeOutput(length);
+        size_t unsent = count - (before - messageQueue.size());
+        queuedAt.insert(queuedAt.begin(), unsent, std::chrono::steady_clock::now());
+        if (!ec) {
             do_write();
         }
+    } else {
+        LOG_ERROR("Write error for client %s: %s", 
+                  clientId.c_str(), ec.message().c_str());
+        stop();
+    }
+}
+
+void Session::consumeOutput(size_t bytes) {
+    size_t written = bytes;
+    size_t messages = 0;
+    while (bytes > 0 && bytes >= messageQueue.front().size()) {
+        bytes -= messageQueue.front().size();
+        messageQueue.pop_front();
+        messages++;
+    }
+    // A partly written message keeps only its unsent tail
+    if (bytes > 0) {
+        messageQueue.front().erase(0, bytes);
+    }
+    
+    outputBytes -= written;
+    MemoryAccounting::getInstance().add(MemoryAccounting::SESSION_OUTPUT, -static_cast<long>(written));
+    LoadShedder::getInstance().addQueued(-static_cast<long>(messages));
+    accounting.counters->add(SessionCounters::BYTES_OUT, written);
+    accounting.counters->add(SessionCounters::MESSAGES_OUT, messages);
+}
+
+void Session::stop() {
+    stopped = true;
+    // The ring holds the socket open for as long as a receive is pending
+    if (ring) {
+        ring->cancel(readOp);
+    }
+    room.leave(shared_from_this());
+    if (heartbeat_timer) {
+        heartbeat_timer->cancel();
     }
 }
 
 void Session::deliver(Message& incomingMessage){
     room.deliver(shared_from_this(), incomingMessage);
 }
-using boost::asio::ip::address_v4;
 
-void accept_connection(boost::asio::io_context &io, char *port,tcp::acceptor &acceptor, Room &room, const tcp::endpoint& endpoint) {
-    tcp::socket socket(io);
-    acceptor.async_accept([&](boost::system::error_code ec, tcp::socket socket) {
-        if(!ec) {
-            std::shared_ptr<Session> session = std::make_shared<Session>(std::move(socket), room);
-            session->start();
+ShmSession::ShmSession(boost::asio::io_context& io, std::unique_ptr<ShmChannel> c, Room& r):
+    pollTimer(io),
+    idleDelay(0),
+    channel(std::move(c)),
+    room(r),
+    clientId("shm:" + channel->getName()),
+    traceId(TrafficCapture::getInstance().connect()) {
+    accounting = SessionAccounting::getInstance().acquire(clientId);
+    LOG_INFO("Shared memory channel ready: %s", channel->getName().c_str());
+    MetricsCollector::getInstance().recordMetric("active_connections", 1);
+}
+
+ShmSession::~ShmSession() {
+    SessionDirectory::getInstance().remove(clientId, this);
+    TrafficCapture::getInstance().disconnect(traceId);
+    SessionAccounting::getInstance().release(accounting);
+    RateLimiter::getInstance().removeClient(clientId);
+    if (handedOver) {
+        return;
+    }
+    LOG_INFO("Shared memory channel closed: %s", channel->getName().c_str());
+    MetricsCollector::getInstance().recordMetric("active_connections", -1);
+}
+
+void ShmSession::start() {
+    SessionDirectory::getInstance().add(clientId, shared_from_this());
+    room.join(shared_from_this());
+    poll();
+}
+
+void ShmSession::pause() {
+    paused = true;
+    pollTimer.cancel();
+}
+
+void ShmSession::resume() {
+    paused = false;
+    poll();
+}
+
+void ShmSession::finishHandover() {
+    // The new process reopens the channel by name and takes over ownership
+    handedOver = true;
+    channel->setOwner(false);
+    room.leave(shared_from_this());
+}
+
+const std::string& ShmSession::getChannelName() const {
+    return channel->getName();
+}
+
+void ShmSession::poll() {
+    auto self(shared_from_this());
+    if (paused) {
+        return;
+    }
+    
+    // Drain a bounded number of records so one busy producer cannot starve the loop
+    size_t drained = 0;
+    while (drained < maxRecordsPerPoll &&
+           channel->toServer().tryPop([&](const char* data, uint32_t length) {
+               handleRecord(data, length);
+           })) {
+        drained++;
+    }
+    
+    // The producer wrote something that is not a valid record; nothing after it can be trusted
+    if (channel->toServer().poisoned()) {
+        LOG_ERROR("Closing shared memory channel %s: corrupt record from the producer",
+                  channel->getName().c_str());
+        MetricsCollector::getInstance().recordMetric("shm_corrupt_channels", 1);
+        room.leave(self);
+        return;
+    }
+    
+    if (drained > 0) {
+        idleDelay = std::chrono::microseconds(0);
+        boost::asio::post(pollTimer.get_executor(), [this, self]() { poll(); });
+        return;
+    }
+    
+    // Back off while idle, from 50us up to 1ms between polls
+    idleDelay = std::min(std::chrono::microseconds(1000),
+                         std::max(std::chrono::microseconds(50), idleDelay * 2));
+    pollTimer.expires_after(idleDelay);
+    pollTimer.async_wait([this, self](const boost::system::error_code& ec) {
+        if (!ec) {
+            poll();
         }
-        accept_connection(io, port,acceptor, room, endpoint);
     });
 }
 
+// A record goes through the same checks as a line from a socket client
+void ShmSession::handleRecord(const char* data, uint32_t length) {
+    auto started = std::chrono::steady_clock::now();
+    TrafficCapture::getInstance().message(traceId, length);
+    accounting.counters->add(SessionCounters::BYTES_IN, length);
+    accounting.counters->add(SessionCounters::MESSAGES_IN, 1);
+    
+    std::string text;
+    const char* rejection = admitInput(data, length, IngestScanner::classify(data, length),
+                                       Session::getControlPolicy(), clientId, text);
+    if (rejection) {
+        push(rejection);
+    } else if (!RateLimiter::getInstance().checkLimit(clientId)) {
+        LOG_WARNING("Rate limit exceeded for client %s", clientId.c_str());
+        push("Rate limit exceeded. Please wait before sending more messages.\n");
+    } else if (filterContent(text, clientId) == PatternMatcher::REJECT) {
+        push("Message rejected by content filter\n");
+    } else {
+        text.resize(IngestScanner::utf8Prefix(text.data(), text.size(), RuntimeConfig::current().maxMessageBytes));
+        Message message(text);
+        room.deliver(shared_from_this(), message);
+    }
+    
+    accounting.counters->add(SessionCounters::PROCESSING_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count());
+}
 
-int main(int argc, char *argv[]) {
-    try {
-        if(argc < 2) {
-            std::cerr << "Usage: server <port> [<port> ...]\n";
-            return 1;
-        }
-        
-        // Initialize logging with file truncation
-        Logger::getInstance().setLogFile("chat_server.log", true); // true = truncate existing log
-        Logger::getInstance().setLogLevel(INFO);
-        LOG_INFO("Server starting up...");
-        
-        // Initialize encryption with a password
-        std::string encryptionKey = "YourSecretKey123";
-        if (!Encryption::initialize(encryptionKey)) {
-            LOG_ERROR("Failed to initialize encryption");
-            return 1;
-        }
-        
-        // Set rate limit (messages per second)
-        RateLimiter::getInstance().setRateLimit(5.0);  // 5 messages per second
-        
-        // Start metrics reporting
-        MetricsCollector::getInstance().startReporting(60, [](const std::string& report) {
-            LOG_INFO("Performance Report:\n%s", report.c_str());
-        });
-        
-        Room room;
-        boost::asio::io_context io_context;
-        tcp::endpoint endpoint(tcp::v4(), atoi(argv[1]));
-        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), std::atoi(argv[1])));
-        
-        LOG_INFO("Server started on port %s", argv[1]);
-        
-        // In main function, add a check for --metrics command
-        if (argc > 1 && std::string(argv[1]) == "--metrics") {
-            // Print metrics and exit
-            std::cout << MetricsCollector::getInstance().generateReport() << std::endl;
-            return 0;
-        }
-        
-        accept_connection(io_context, argv[1], acceptor, room, endpoint);
-        io_context.run();
+void ShmSession::write(Message &message) {
+    if (!message.decodeHeader()) {
+        return;
     }
-    catch (std::exception& e) {
-        LOG_ERROR("Exception: %s", e.what());
+    push(message.getBody());
+}
+
+void ShmSession::push(const std::string& body) {
+    // The ring has a single producer: output from other threads is handed to the loop
+    if (!inLoopThread()) {
+        auto self(shared_from_this());
+        boost::asio::post(pollTimer.get_executor(), [this, self, body]() { push(body); });
+        return;
+    }
+    // The new process produces into the ring now
+    if (handedOver) {
+        return;
     }
     
-    return 0;
-}
\ No newline at end of file
+    // One record per message: server notices lose their line ending
+    size_t length = !body.empty() && body.back() == '\n' ? body.size() - 1 : body.size();
+    if (!channel->toClient().tryPush(body.data(), static_cast<uint32_t>(length))) {
+        // Nobody is draining the ring; drop rather than block the room
+        MetricsCollector::getInstance().recordMetric("shm_dropped_messages", 1);
+        return;
+    }
+    accounting.counters->add(SessionCounters::BYTES_OUT, length);
+    accounting.counters->add(SessionCounters::MESSAGES_OUT, 1);
+}
+
+bool ShmSession::inLoopThread() {
+    auto executor = pollTimer.get_executor();
+    typedef boost::asio::io_context::executor_type LoopExecutor;
+    if (executor.target_type() == typeid(LoopExecutor)) {
+        return executor.target<LoopExecutor>()->running_in_this_thread();
+    }
+    return true;
+}
+
+void ShmSession::deliver(Message& incomingMessage){
+    room.deliver(shared_from_this(), incomingMessage);
+}
@@ -4,54 +4,260 @@
 #define CHATROOM_HPP
 
 #include "message.hpp"
+#include "ingest.hpp"
+#include "session_accounting.hpp"
 #include <deque>
 #include <set>
+#include <vector>
 #include <memory>
+#include <mutex>
+#include <utility>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <iostream>
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 
 using boost::asio::ip::tcp;
 
+class ShmChannel;
+class UringLoop;
+
+// Everything needed to continue a session in another process (see hot_restart.hpp)
+struct SessionState {
+    std::string clientId;
+    std::string nick;
+    std::string listener;
+    std::string pendingInput;
+    std::vector<std::string> pendingOutput;
+};
+
+// How a listener wants its sessions served (see listener.hpp)
+struct SessionProfile {
+    enum Framing {
+        NEWLINE,   // text lines ending in '\n'
+        BINARY     // Message frames: 4-digit length header, then the body
+    };
+    std::string listener;
+    Framing framing = NEWLINE;
+    double rateLimit = 0;   // messages per second; 0 uses the server-wide limit
+    double burst = 0;       // 0 uses the server-wide burst
+};
+
+typedef std::shared_ptr<const SessionProfile> SessionProfilePointer;
+
+class Participant;
+
+// Messages a batching room fans out in one go (see Room::setBatching)
+struct RoomBatch {
+    std::vector<Message> messages;
+    std::vector<const Participant*> senders;  // parallel to messages; nullptr if remote
+    std::string frame;                        // every body, each terminated by '\n'
+};
+
 class Participant {
     public: 
         virtual void deliver(Message& message) = 0;
         virtual void write(Message &message) = 0;
+        // Receives a whole batch; by default its messages are written one by one
+        virtual void writeBatch(RoomBatch& batch) {
+            for (size_t i = 0; i < batch.messages.size(); ++i) {
+                if (batch.senders[i] != this) {
+                    write(batch.messages[i]);
+                }
+            }
+        }
         virtual ~Participant() = default;
 };
 
 typedef std::shared_ptr<Participant> ParticipantPointer;
 
+// Carries room traffic to other chatApp processes (see cluster.hpp)
+class RoomRelay {
+    public:
+        // Called for every message that originated on this node
+        virtual void publish(const std::string& room, Message& message) = 0;
+        // Called when a room gains its first or loses its last local member
+        virtual void setInterest(const std::string& room, bool interested) = 0;
+        virtual ~RoomRelay() = default;
+};
+
 class Room{
     public:
+        explicit Room(std::string name = "lobby");
         void join(ParticipantPointer participant);
         void leave(ParticipantPointer participant);
         void deliver(ParticipantPointer participantPointer, Message &message);
+        // Deliver a message that was published by another node; it is not relayed again
+        void deliverRemote(Message &message);
+        std::vector<ParticipantPointer> getParticipants() const;
+        std::vector<std::string> getHistory();
+        void restoreHistory(const std::vector<std::string>& bodies);
+        void setRelay(RoomRelay* relay);
+        // Opt-in micro-batching: messages arriving within window (or until
+        // maxMessages are pending) go out to each member as one write.
+        // A zero window turns batching off again.
+        void setBatching(boost::asio::any_io_executor executor,
+                         std::chrono::microseconds window, size_t maxMessages);
+        // Fan out whatever is pending now instead of waiting for the tick
+        void flush();
+        const std::string& getName() const { return name; }
+        bool hasMembers() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return !participants.empty();
+        }
     private:
+        void deliverLocal(ParticipantPointer sender, Message &message);
+        void enqueueBatch(const Participant* sender, Message &message);
+        void flushLocked();
+        // Sessions of listeners with their own workers deliver from other threads
+        mutable std::mutex mtx;
+        std::string name;
+        RoomRelay* relay = nullptr;
         std::deque<Message> messageQueue;
         enum {maxParticipants = 100};
         std::set<ParticipantPointer> participants;
+        std::chrono::microseconds batchWindow{0};
+        size_t maxBatchMessages = 0;
+        std::unique_ptr<boost::asio::steady_timer> batchTimer;
+        // Counts flushed batches; a tick only flushes the batch it was started for
+        uint64_t batchGeneration = 0;
+        RoomBatch pendingBatch;
+        std::vector<std::chrono::steady_clock::time_point> pendingArrivals;
 };
 
 class Session: public Participant, public std::enable_shared_from_this<Session>{
     public:
-        Session(tcp::socket s, Room &room);
+        // TCP and Unix domain stream sockets are both accepted as a generic stream socket
+        typedef boost::asio::generic::stream_protocol::socket Socket;
+
+        Session(Socket s, Room &room, SessionProfilePointer profile = defaultProfile());
+        // Continue a session handed over by another process
+        Session(Socket s, Room &room, const SessionState& state,
+                SessionProfilePointer profile = defaultProfile());
         virtual ~Session();
         void start();
         void deliver(Message& message) override;
         void write(Message &message) override;
+        void writeBatch(RoomBatch& batch) override;
         void async_read();
         void async_write(std::string messageBody, size_t messageLength);
         void do_write();
+        
+        // Hot restart: pause() stops reading, writing and heartbeats; once
+        // isWriting() is false the state can be exported and the socket handed over.
+        // cancelWrite() stops a write that takes too long; what it did not send
+        // stays queued.
+        void pause();
+        void resume();
+        bool isWriting() const { return writing; }
+        void cancelWrite();
+        SessionState exportState();
+        void finishHandover();
+        int nativeHandle() { return clientSocket.native_handle(); }
+        boost::asio::any_io_executor getExecutor() { return clientSocket.get_executor(); }
+        const std::string& getClientId() const { return clientId; }
+        
+        // Whether the calling thread runs this session's handlers; false for
+        // sessions of a listener with its own workers, seen from elsewhere
+        bool inSessionThread();
+        
+        // Whether lines with control characters are cleaned up or refused
+        static void setControlPolicy(IngestScanner::ControlPolicy policy) { controlPolicy = policy; }
+        static IngestScanner::ControlPolicy getControlPolicy() { return controlPolicy; }
+        static SessionProfilePointer defaultProfile();
     private:
-        tcp::socket clientSocket;
+        enum {maxWriteBatch = 64};
+        enum {readChunk = 16384};
+        // Handles every complete line (or frame) in the buffer; false if the session had to stop
+        bool processInput();
+        // Takes over from async_read once bytes have arrived in the buffer's prepared space
+        void readDone(const boost::system::error_code& ec, size_t bytes);
+        void writeDone(const boost::system::error_code& ec, size_t length, size_t count);
+        void extractLines();
+        bool extractFrames();
+        void handleLine(std::string data);
+        // Output from any thread; handed to the session's own thread if need be
+        void queueOutput(std::string data);
+        // Server notices, one line each, framed for the session's protocol
+        void notify(const std::string& text);
+        // Leaves the room and cancels the heartbeat so the session can be destroyed
+        void stop();
+        // Brings the input buffer's share of the memory accounting up to date
+        void accountInput();
+        // Drops bytes written from the front of the output queue
+        void consumeOutput(size_t bytes);
+        // Handles /msg and /nick; returns false if data is not a command
+        bool handleCommand(const std::string& data);
+        // Runs the content filter over message text only, never over a command
+        // or its arguments; false if the text is rejected
+        bool filterText(std::string& text);
+        Socket clientSocket;
+        SessionProfilePointer profile;
         boost::asio::streambuf buffer;
+        IngestScanner scanner;
         Room& room;
-        std::deque<Message> messageQueue; 
+        std::deque<std::string> messageQueue; 
+        size_t accountedInput = 0;
+        size_t outputBytes = 0;
+        bool overBudget = false;
+        bool writing = false;
+        bool readPending = false;
+        bool paused = false;
+        bool handedOver = false;
+        bool stopped = false;
+        // Set when the socket is served by io_uring (see io_backend.hpp), with the requests in flight
+        UringLoop* ring = nullptr;
+        uint64_t readOp = 0;
+        uint64_t writeOp = 0;
         std::string clientId;
+        std::string nick;
+        // Connection number in the traffic capture, if one is running
+        uint64_t traceId;
+        // Resource counters (see session_accounting.hpp), and when each queued output was queued
+        SessionAccounting::Slot accounting;
+        std::deque<std::chrono::steady_clock::time_point> queuedAt;
+        std::string accountingLabel() const;
         std::unique_ptr<boost::asio::steady_timer> heartbeat_timer;
         void start_heartbeat_timer();
+        static inline IngestScanner::ControlPolicy controlPolicy = IngestScanner::STRIP_CONTROLS;
+};
+
+// Participant fed by a shared-memory ring pair (see shm_ring.hpp) instead of
+// a socket, for high-rate producers on the same host. Inbound records are
+// polled from the io_context; one record is one chat message, checked like
+// a line from a socket client (the server-wide rate limit applies). Output
+// from sessions on worker listeners is pushed from the loop too, as the
+// client ring has a single producer.
+class ShmSession: public Participant, public std::enable_shared_from_this<ShmSession>{
+    public:
+        ShmSession(boost::asio::io_context& io, std::unique_ptr<ShmChannel> channel, Room &room);
+        virtual ~ShmSession();
+        void start();
+        void deliver(Message& message) override;
+        void write(Message &message) override;
+        void pause();
+        void resume();
+        void finishHandover();
+        const std::string& getChannelName() const;
+    private:
+        void poll();
+        // Validation, rate limit and content filter, as for Session::handleLine
+        void handleRecord(const char* data, uint32_t length);
+        // Sends one record to the producer, or drops it if the ring is full;
+        // runs on the loop whichever thread calls it
+        void push(const std::string& body);
+        bool inLoopThread();
+        bool paused = false;
+        bool handedOver = false;
+        enum {maxRecordsPerPoll = 256};
+        boost::asio::steady_timer pollTimer;
+        std::chrono::microseconds idleDelay;
+        std::unique_ptr<ShmChannel> channel;
+        Room& room;
+        std::string clientId;
+        uint64_t traceId;
+        SessionAccounting::Slot accounting;
 };
 
 #endif CHATROOM_HPP
\ No newline at end of file
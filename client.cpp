@@ -1,11 +1,14 @@
 #include "message.hpp"
 #include <iostream>
+#include <utility>
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 
 using boost::asio::ip::tcp;
+typedef boost::asio::generic::stream_protocol::socket Socket;
 
 
-void async_read(tcp::socket &socket, bool &connected) {
+void async_read(Socket &socket, bool &connected) {
     auto buffer = std::make_shared<boost::asio::streambuf>();
     boost::asio::async_read_until(socket, *buffer, "\n",
         [&socket, buffer, &connected](boost::system::error_code ec, std::size_t length) {
@@ -29,15 +32,24 @@ void async_read(tcp::socket &socket, bool &connected) {
 
 int main(int argc, char* argv[]){
     if(argc < 2){
-        std::cerr << "Provide port too as second argument" << std::endl;
+        std::cerr << "Provide port (or unix:<path>) too as second argument" << std::endl;
         return 1;
     }
     
     boost::asio::io_context io_context;
-    tcp::socket socket(io_context);
-    tcp::resolver resolver(io_context);
+    Socket socket(io_context);
+    std::string target = argv[1];
 
-    boost::asio::connect(socket, resolver.resolve("127.0.0.1", argv[1]));
+    if (target.rfind("unix:", 0) == 0) {
+        boost::asio::local::stream_protocol::socket local(io_context);
+        local.connect(boost::asio::local::stream_protocol::endpoint(target.substr(5)));
+        socket = Socket(std::move(local));
+    } else {
+        tcp::socket tcpSocket(io_context);
+        tcp::resolver resolver(io_context);
+        boost::asio::connect(tcpSocket, resolver.resolve("127.0.0.1", argv[1]));
+        socket = Socket(std::move(tcpSocket));
+    }
 
     bool connected = true;
     async_read(socket, connected);
@@ -0,0 +1,480 @@
+#include "cluster.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "wire.hpp"
+
+namespace {
+
+void appendFrame(std::string& out, uint8_t type, const std::string& payload) {
+    appendU32(out, static_cast<uint32_t>(payload.size() + 1));
+    out.push_back(static_cast<char>(type));
+    out += payload;
+}
+
+} // namespace
+
+bool ClusterAddress::parse(const std::string& spec, ClusterAddress& out) {
+    if (spec.rfind("unix:", 0) == 0) {
+        out.isUnix = true;
+        out.path = spec.substr(5);
+        return !out.path.empty();
+    }
+
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    out.isUnix = false;
+    out.host = colon == 0 ? "0.0.0.0" : spec.substr(0, colon);
+    int port = std::atoi(spec.c_str() + colon + 1);
+    if (port <= 0 || port > 65535) {
+        return false;
+    }
+    out.port = static_cast<unsigned short>(port);
+    return true;
+}
+
+std::string ClusterAddress::toString() const {
+    if (isUnix) {
+        return "unix:" + path;
+    }
+    return host + ":" + std::to_string(port);
+}
+
+PeerLink::PeerLink(Socket s, ClusterNode& n, bool isOutbound, size_t index):
+    socket(std::move(s)),
+    node(n),
+    outbound(isOutbound),
+    peerIndex(index),
+    readBuffer(64 * 1024) {}
+
+void PeerLink::start() {
+    sendControl(ClusterNode::HELLO, node.getNodeId());
+    for (const auto& room : node.getLocalInterest()) {
+        sendControl(ClusterNode::SUBSCRIBE, room);
+    }
+    async_read();
+}
+
+void PeerLink::close() {
+    if (!open) return;
+    open = false;
+
+    boost::system::error_code ec;
+    socket.close(ec);
+    node.onLinkClosed(shared_from_this());
+}
+
+void PeerLink::sendControl(uint8_t type, const std::string& payload) {
+    if (!open) return;
+    appendFrame(pendingControl, type, payload);
+    pendingBytes += payload.size() + 5;
+    flush();
+}
+
+void PeerLink::sendMessage(const std::string& room, const std::string& body, uint64_t sentNs) {
+    if (!open) return;
+
+    // A peer that cannot keep up loses messages rather than growing memory without bound
+    if (pendingBytes > ClusterNode::maxPendingBytes) {
+        MetricsCollector::getInstance().recordMetric("cluster_dropped_messages", 1);
+        return;
+    }
+
+    auto& batch = pendingBatches[room];
+    batch.first++;
+    appendU64(batch.second, sentNs);
+    appendU16(batch.second, static_cast<uint16_t>(body.size()));
+    batch.second += body;
+    pendingBytes += body.size() + 10;
+
+    flush();
+}
+
+void PeerLink::flush() {
+    if (writing || !open || (pendingControl.empty() && pendingBatches.empty())) {
+        return;
+    }
+
+    // Control frames go first so subscriptions are applied before any data
+    inflight.clear();
+    inflight.swap(pendingControl);
+    for (auto& entry : pendingBatches) {
+        const std::string& room = entry.first;
+        uint32_t count = entry.second.first;
+        const std::string& data = entry.second.second;
+
+        appendU32(inflight, static_cast<uint32_t>(1 + 2 + room.size() + 4 + data.size()));
+        inflight.push_back(static_cast<char>(ClusterNode::BATCH));
+        appendU16(inflight, static_cast<uint16_t>(room.size()));
+        inflight += room;
+        appendU32(inflight, count);
+        inflight += data;
+
+        MetricsCollector::getInstance().recordMetric("cluster_batch_size", count);
+    }
+    pendingBatches.clear();
+    pendingBytes = 0;
+
+    writing = true;
+    auto self(shared_from_this());
+    boost::asio::async_write(socket, boost::asio::buffer(inflight),
+        [this, self](boost::system::error_code ec, std::size_t length) {
+            writing = false;
+            if (ec) {
+                LOG_WARNING("Cluster link to %s write error: %s",
+                            peerId.c_str(), ec.message().c_str());
+                close();
+                return;
+            }
+            node.countBytesOut(length);
+            flush();
+        });
+}
+
+void PeerLink::async_read() {
+    auto self(shared_from_this());
+    if (readLength == readBuffer.size()) {
+        readBuffer.resize(readBuffer.size() * 2);
+    }
+
+    socket.async_read_some(
+        boost::asio::buffer(readBuffer.data() + readLength, readBuffer.size() - readLength),
+        [this, self](boost::system::error_code ec, std::size_t length) {
+            if (ec) {
+                if (open && ec != boost::asio::error::eof) {
+                    LOG_WARNING("Cluster link to %s read error: %s",
+                                peerId.c_str(), ec.message().c_str());
+                }
+                close();
+                return;
+            }
+            node.countBytesIn(length);
+            readLength += length;
+
+            // Handle every complete frame in the buffer
+            size_t offset = 0;
+            while (readLength - offset >= 4) {
+                uint32_t frameLength = static_cast<uint32_t>(readLE(readBuffer.data() + offset, 4));
+                if (frameLength == 0 || frameLength > ClusterNode::maxFrameBytes) {
+                    LOG_ERROR("Cluster link to %s sent an invalid frame", peerId.c_str());
+                    close();
+                    return;
+                }
+                if (readLength - offset < 4 + static_cast<size_t>(frameLength)) {
+                    if (readBuffer.size() < 4 + static_cast<size_t>(frameLength)) {
+                        readBuffer.resize(4 + frameLength);
+                    }
+                    break;
+                }
+
+                const char* frame = readBuffer.data() + offset + 4;
+                if (!handleFrame(static_cast<uint8_t>(frame[0]), frame + 1, frameLength - 1)) {
+                    LOG_ERROR("Cluster link to %s sent a malformed frame", peerId.c_str());
+                    close();
+                    return;
+                }
+                if (!open) return;
+                offset += 4 + frameLength;
+            }
+
+            // Keep any partial frame at the start of the buffer
+            if (offset > 0) {
+                std::memmove(readBuffer.data(), readBuffer.data() + offset, readLength - offset);
+                readLength -= offset;
+            }
+            async_read();
+        });
+}
+
+bool PeerLink::handleFrame(uint8_t type, const char* payload, size_t length) {
+    switch (type) {
+        case ClusterNode::HELLO:
+            peerId.assign(payload, length);
+            node.onHello(shared_from_this());
+            return true;
+        case ClusterNode::SUBSCRIBE:
+            remoteInterest.insert(std::string(payload, length));
+            return true;
+        case ClusterNode::UNSUBSCRIBE:
+            remoteInterest.erase(std::string(payload, length));
+            return true;
+        case ClusterNode::BATCH: {
+            if (length < 2) return false;
+            size_t roomLength = readLE(payload, 2);
+            if (length < 2 + roomLength + 4) return false;
+            std::string room(payload + 2, roomLength);
+            size_t offset = 2 + roomLength;
+            uint32_t count = static_cast<uint32_t>(readLE(payload + offset, 4));
+            offset += 4;
+
+            for (uint32_t i = 0; i < count; ++i) {
+                if (length - offset < 10) return false;
+                uint64_t sentNs = readLE(payload + offset, 8);
+                size_t bodyLength = readLE(payload + offset + 8, 2);
+                offset += 10;
+                if (length - offset < bodyLength) return false;
+                node.onRemoteBatch(room, std::string(payload + offset, bodyLength), sentNs);
+                offset += bodyLength;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+ClusterNode::ClusterNode(boost::asio::io_context& ioContext, std::string id):
+    io(ioContext),
+    nodeId(std::move(id)) {
+    start_stats_timer();
+}
+
+uint64_t ClusterNode::nowNs() {
+    // steady_clock is CLOCK_MONOTONIC on Linux, which is shared by every
+    // process on the host, so timestamps are comparable across local nodes
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ClusterNode::attach(Room& room) {
+    rooms[room.getName()] = &room;
+    room.setRelay(this);
+}
+
+void ClusterNode::listen(const ClusterAddress& address, int existingFd) {
+    if (address.isUnix) {
+        if (existingFd >= 0) {
+            unixAcceptor = std::make_unique<boost::asio::local::stream_protocol::acceptor>(
+                io, boost::asio::local::stream_protocol(), existingFd);
+        } else {
+            ::unlink(address.path.c_str());
+            unixAcceptor = std::make_unique<boost::asio::local::stream_protocol::acceptor>(
+                io, boost::asio::local::stream_protocol::endpoint(address.path));
+        }
+        accept_unix();
+    } else {
+        boost::asio::ip::tcp::endpoint endpoint(
+            boost::asio::ip::make_address(address.host), address.port);
+        if (existingFd >= 0) {
+            tcpAcceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(io, endpoint.protocol(), existingFd);
+        } else {
+            tcpAcceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(io, endpoint);
+        }
+        accept_tcp();
+    }
+    LOG_INFO("Cluster node %s listening on %s", nodeId.c_str(), address.toString().c_str());
+}
+
+int ClusterNode::listenerHandle() {
+    if (unixAcceptor) return unixAcceptor->native_handle();
+    if (tcpAcceptor) return tcpAcceptor->native_handle();
+    return -1;
+}
+
+void ClusterNode::pauseListener() {
+    boost::system::error_code ec;
+    if (unixAcceptor) unixAcceptor->cancel(ec);
+    if (tcpAcceptor) tcpAcceptor->cancel(ec);
+}
+
+void ClusterNode::resumeListener() {
+    if (unixAcceptor) accept_unix();
+    if (tcpAcceptor) accept_tcp();
+}
+
+void ClusterNode::closeListener() {
+    boost::system::error_code ec;
+    if (unixAcceptor) unixAcceptor->close(ec);
+    if (tcpAcceptor) tcpAcceptor->close(ec);
+}
+
+void ClusterNode::accept_tcp() {
+    tcpAcceptor->async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (!ec) {
+            socket.set_option(tcp::no_delay(true));
+            addLink(PeerLink::Socket(std::move(socket)), false, 0);
+        }
+        accept_tcp();
+    });
+}
+
+void ClusterNode::accept_unix() {
+    unixAcceptor->async_accept(
+        [this](boost::system::error_code ec, boost::asio::local::stream_protocol::socket socket) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (!ec) {
+                addLink(PeerLink::Socket(std::move(socket)), false, 0);
+            }
+            accept_unix();
+        });
+}
+
+void ClusterNode::addPeer(const ClusterAddress& address) {
+    peers.push_back(address);
+    connect(peers.size() - 1);
+}
+
+void ClusterNode::connect(size_t peerIndex) {
+    const ClusterAddress& address = peers[peerIndex];
+
+    if (address.isUnix) {
+        auto socket = std::make_shared<boost::asio::local::stream_protocol::socket>(io);
+        socket->async_connect(boost::asio::local::stream_protocol::endpoint(address.path),
+            [this, socket, peerIndex](boost::system::error_code ec) {
+                if (ec) {
+                    scheduleReconnect(peerIndex);
+                    return;
+                }
+                addLink(PeerLink::Socket(std::move(*socket)), true, peerIndex);
+            });
+        return;
+    }
+
+    auto resolver = std::make_shared<tcp::resolver>(io);
+    resolver->async_resolve(address.host, std::to_string(address.port),
+        [this, resolver, peerIndex](boost::system::error_code ec, tcp::resolver::results_type results) {
+            if (ec) {
+                scheduleReconnect(peerIndex);
+                return;
+            }
+            auto socket = std::make_shared<tcp::socket>(io);
+            boost::asio::async_connect(*socket, results,
+                [this, socket, peerIndex](boost::system::error_code ec, const tcp::endpoint&) {
+                    if (ec) {
+                        scheduleReconnect(peerIndex);
+                        return;
+                    }
+                    socket->set_option(tcp::no_delay(true));
+                    addLink(PeerLink::Socket(std::move(*socket)), true, peerIndex);
+                });
+        });
+}
+
+void ClusterNode::scheduleReconnect(size_t peerIndex) {
+    auto timer = std::make_shared<boost::asio::steady_timer>(io, std::chrono::seconds(1));
+    timer->async_wait([this, timer, peerIndex](const boost::system::error_code& ec) {
+        if (!ec) {
+            connect(peerIndex);
+        }
+    });
+}
+
+void ClusterNode::addLink(PeerLink::Socket socket, bool outbound, size_t peerIndex) {
+    auto link = std::make_shared<PeerLink>(std::move(socket), *this, outbound, peerIndex);
+    links.insert(link);
+    if (outbound) {
+        LOG_INFO("Cluster link established to %s", peers[peerIndex].toString().c_str());
+    }
+    link->start();
+}
+
+void ClusterNode::onHello(const PeerLinkPointer& link) {
+    if (link->getPeerId() == nodeId) {
+        LOG_ERROR("Cluster peer reports our own node id %s; closing link", nodeId.c_str());
+        link->close();
+        return;
+    }
+
+    // Two nodes that both list each other as peers end up with two links.
+    // Both sides keep the link dialed by the node with the smaller id.
+    for (const auto& other : links) {
+        if (other == link || !other->isOpen() || other->getPeerId() != link->getPeerId()) {
+            continue;
+        }
+        bool keepNew = link->isOutbound() == (nodeId < link->getPeerId());
+        PeerLinkPointer loser = keepNew ? other : link;
+        loser->close();
+        break;
+    }
+
+    if (link->isOpen()) {
+        LOG_INFO("Cluster peer %s joined", link->getPeerId().c_str());
+    }
+}
+
+void ClusterNode::onLinkClosed(const PeerLinkPointer& link) {
+    links.erase(link);
+
+    bool replaced = false;
+    for (const auto& other : links) {
+        if (!link->getPeerId().empty() && other->getPeerId() == link->getPeerId()) {
+            replaced = true;
+        }
+    }
+    if (!replaced) {
+        LOG_INFO("Cluster peer %s left", link->getPeerId().c_str());
+        if (link->isOutbound()) {
+            scheduleReconnect(link->getPeerIndex());
+        }
+    }
+}
+
+void ClusterNode::publish(const std::string& room, Message& message) {
+    // Rooms are fed by listeners with their own workers too; links live on the main loop
+    if (!io.get_executor().running_in_this_thread()) {
+        boost::asio::post(io, [this, room, body = message.getBody(), sentNs = nowNs()]() {
+            forward(room, body, sentNs);
+        });
+        return;
+    }
+    if (links.empty()) return;
+
+    forward(room, message.getBody(), nowNs());
+}
+
+void ClusterNode::forward(const std::string& room, const std::string& body, uint64_t sentNs) {
+    for (const auto& link : links) {
+        if (link->wantsRoom(room)) {
+            link->sendMessage(room, body, sentNs);
+        }
+    }
+}
+
+void ClusterNode::setInterest(const std::string& room, bool interested) {
+    if (!io.get_executor().running_in_this_thread()) {
+        boost::asio::post(io, [this, room, interested]() { setInterest(room, interested); });
+        return;
+    }
+    if (interested) {
+        localInterest.insert(room);
+    } else {
+        localInterest.erase(room);
+    }
+    for (const auto& link : links) {
+        link->sendControl(interested ? SUBSCRIBE : UNSUBSCRIBE, room);
+    }
+}
+
+void ClusterNode::onRemoteBatch(const std::string& roomName, const std::string& body, uint64_t sentNs) {
+    auto it = rooms.find(roomName);
+    if (it == rooms.end()) return;
+
+    uint64_t now = nowNs();
+    if (now > sentNs) {
+        MetricsCollector::getInstance().recordMetric("cluster_delivery_latency", (now - sentNs) / 1000.0);
+    }
+
+    Message message(body);
+    it->second->deliverRemote(message);
+}
+
+void ClusterNode::start_stats_timer() {
+    statsTimer = std::make_unique<boost::asio::steady_timer>(io);
+    statsTimer->expires_after(std::chrono::seconds(1));
+    statsTimer->async_wait([this](const boost::system::error_code& ec) {
+        if (ec) return;
+
+        // Inter-node bandwidth over the last second
+        if (!links.empty()) {
+            MetricsCollector::getInstance().recordMetric("cluster_bytes_in_per_sec", bytesIn.exchange(0));
+            MetricsCollector::getInstance().recordMetric("cluster_bytes_out_per_sec", bytesOut.exchange(0));
+        }
+        start_stats_timer();
+    });
+}
@@ -0,0 +1,146 @@
+#ifndef CLUSTER_HPP
+#define CLUSTER_HPP
+
+#include "chatroom.hpp"
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+
+// Cluster mode: several chatApp processes federate their rooms over TCP or
+// Unix-socket links. Every node keeps one link per peer; a node announces
+// which rooms it has local members in (SUBSCRIBE/UNSUBSCRIBE) and peers only
+// forward messages for those rooms.
+//
+// Frames on a link are length prefixed:
+//     u32 length (of type + payload, little endian) | u8 type | payload
+//
+//     HELLO        nodeId
+//     SUBSCRIBE    room name
+//     UNSUBSCRIBE  room name
+//     BATCH        u16 roomLen | room | u32 count |
+//                  count x (u64 sentNs | u16 bodyLen | body)
+//
+// Messages published while a write is in flight are coalesced into a single
+// BATCH frame per room and written with one gathered write once the link is
+// free, so a busy link pipelines many messages per syscall.
+
+class ClusterNode;
+
+// Address of a cluster link endpoint: "unix:/path/to.sock" or "host:port"
+struct ClusterAddress {
+    bool isUnix = false;
+    std::string path;
+    std::string host;
+    unsigned short port = 0;
+
+    static bool parse(const std::string& spec, ClusterAddress& out);
+    std::string toString() const;
+};
+
+class PeerLink : public std::enable_shared_from_this<PeerLink> {
+    public:
+        typedef boost::asio::generic::stream_protocol::socket Socket;
+
+        PeerLink(Socket socket, ClusterNode& node, bool outbound, size_t peerIndex);
+        void start();
+        void close();
+        void sendControl(uint8_t type, const std::string& payload);
+        void sendMessage(const std::string& room, const std::string& body, uint64_t sentNs);
+        bool wantsRoom(const std::string& room) const { return remoteInterest.count(room) > 0; }
+        bool isOutbound() const { return outbound; }
+        size_t getPeerIndex() const { return peerIndex; }
+        const std::string& getPeerId() const { return peerId; }
+        bool isOpen() const { return open; }
+    private:
+        void async_read();
+        bool handleFrame(uint8_t type, const char* payload, size_t length);
+        void flush();
+
+        Socket socket;
+        ClusterNode& node;
+        bool outbound;
+        size_t peerIndex;
+        bool open = true;
+        std::string peerId;
+        std::set<std::string> remoteInterest;
+
+        std::vector<char> readBuffer;
+        size_t readLength = 0;
+
+        // Frames waiting for the link plus per-room batches still being filled
+        std::string pendingControl;
+        std::map<std::string, std::pair<uint32_t, std::string>> pendingBatches;
+        size_t pendingBytes = 0;
+        std::string inflight;
+        bool writing = false;
+};
+
+typedef std::shared_ptr<PeerLink> PeerLinkPointer;
+
+class ClusterNode : public RoomRelay {
+    public:
+        enum FrameType : uint8_t {
+            HELLO = 1,
+            SUBSCRIBE = 2,
+            UNSUBSCRIBE = 3,
+            BATCH = 4
+        };
+
+        // Links whose unsent data exceeds this are considered stuck and drop messages
+        enum {maxPendingBytes = 4 * 1024 * 1024};
+        enum {maxFrameBytes = 16 * 1024 * 1024};
+
+        ClusterNode(boost::asio::io_context& io, std::string nodeId);
+
+        void attach(Room& room);
+        // Listen on address, or adopt an already listening socket handed over by a hot restart
+        void listen(const ClusterAddress& address, int existingFd = -1);
+        int listenerHandle();
+        void pauseListener();
+        void resumeListener();
+        void closeListener();
+        void addPeer(const ClusterAddress& address);
+
+        // RoomRelay
+        void publish(const std::string& room, Message& message) override;
+        void setInterest(const std::string& room, bool interested) override;
+
+        const std::string& getNodeId() const { return nodeId; }
+        const std::set<std::string>& getLocalInterest() const { return localInterest; }
+
+        // Called by PeerLink
+        void onHello(const PeerLinkPointer& link);
+        void onLinkClosed(const PeerLinkPointer& link);
+        void onRemoteBatch(const std::string& room, const std::string& body, uint64_t sentNs);
+        void countBytesIn(size_t bytes) { bytesIn += bytes; }
+        void countBytesOut(size_t bytes) { bytesOut += bytes; }
+
+        static uint64_t nowNs();
+    private:
+        void accept_tcp();
+        void accept_unix();
+        void connect(size_t peerIndex);
+        void scheduleReconnect(size_t peerIndex);
+        void addLink(PeerLink::Socket socket, bool outbound, size_t peerIndex);
+        void forward(const std::string& room, const std::string& body, uint64_t sentNs);
+        void start_stats_timer();
+
+        boost::asio::io_context& io;
+        std::string nodeId;
+        std::map<std::string, Room*> rooms;
+        std::set<std::string> localInterest;
+        std::set<PeerLinkPointer> links;
+        std::vector<ClusterAddress> peers;
+
+        std::unique_ptr<boost::asio::ip::tcp::acceptor> tcpAcceptor;
+        std::unique_ptr<boost::asio::local::stream_protocol::acceptor> unixAcceptor;
+        std::unique_ptr<boost::asio::steady_timer> statsTimer;
+
+        std::atomic<uint64_t> bytesIn{0};
+        std::atomic<uint64_t> bytesOut{0};
+};
+
+#endif // CLUSTER_HPP
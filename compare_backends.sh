@@ -0,0 +1,84 @@
+#!/bin/bash
+# Compare the epoll and io_uring backends of chatApp under the same load
+#
+# Runs one chatApp build with --io-backend epoll and then io_uring, drives
+# each with loadApp and prints the throughput/latency JSON next to the
+# server's system calls: the total and the eight most frequent.
+# Syscalls are counted with the kernel's syscall tracepoints (perf events,
+# so this needs root and tracefs); unlike strace that does not slow the
+# server down. Counts are also written to syscalls-<backend>.json.
+#
+# Usage: ./compare_backends.sh [port] [clients] [messages] [size]
+
+PORT=${1:-9100}
+CLIENTS=${2:-50}
+MESSAGES=${3:-2000}
+SIZE=${4:-64}
+
+make chatApp loadApp > /dev/null || exit 1
+
+TRACEFS=/sys/kernel/tracing
+[ -e $TRACEFS/events ] || mount -t tracefs nodev $TRACEFS 2> /dev/null
+
+# Runs a command with its system calls counted; writes the counts as JSON to
+# the file in $1 once the command exits, and its pid to $2 right away
+count_syscalls() {
+    python3 - "$@" <<'EOF'
+import ctypes, json, os, signal, struct, sys
+
+out, pidfile, command = sys.argv[1], sys.argv[2], sys.argv[3:]
+tracing = "/sys/kernel/tracing/events/"
+events = ["raw_syscalls/sys_enter"] + sorted("syscalls/" + name for name in os.listdir(tracing + "syscalls")
+                                            if name.startswith("sys_enter_")) if os.path.isdir(tracing + "syscalls") else []
+libc = ctypes.CDLL(None, use_errno=True)
+PERF_EVENT_OPEN = 298  # x86-64
+
+child = os.fork()
+if child == 0:
+    os.kill(os.getpid(), signal.SIGSTOP)
+    os.execvp(command[0], command)
+os.waitpid(child, os.WUNTRACED)
+
+counters = {}
+for event in events:
+    try:
+        with open(tracing + event + "/id") as f:
+            config = int(f.read())
+    except OSError:
+        continue
+    # perf_event_attr: tracepoint, counting the process and every thread it starts
+    attr = bytearray(128)
+    struct.pack_into("IIQ", attr, 0, 2, len(attr), config)
+    struct.pack_into("Q", attr, 40, (1 << 0) | (1 << 1) | (1 << 12))  # disabled, inherit, enable_on_exec
+    fd = libc.syscall(PERF_EVENT_OPEN, ctypes.create_string_buffer(bytes(attr)), child, -1, -1, 0)
+    if fd >= 0:
+        counters[event.split("/")[1].replace("sys_enter_", "").replace("sys_enter", "total")] = fd
+
+with open(pidfile, "w") as f:
+    f.write(str(child))
+os.kill(child, signal.SIGCONT)
+os.waitpid(child, 0)
+
+counts = {name: struct.unpack("Q", os.read(fd, 8))[0] for name, fd in counters.items()}
+# The total, then the busiest calls
+top = sorted((item for item in counts.items() if item[0] != "total" and item[1] > 0), key=lambda item: -item[1])
+with open(out, "w") as f:
+    json.dump(dict([("total", counts.get("total", 0))] + top[:8]), f)
+EOF
+}
+
+for BACKEND in epoll io_uring; do
+    rm -f server.pid
+    count_syscalls syscalls-$BACKEND.json server.pid \
+        ./chatApp $PORT --rate-limit 1000000 --io-backend $BACKEND > /dev/null &
+    COUNTER=$!
+    sleep 1
+
+    echo -n "$BACKEND: "
+    ./loadApp $PORT --clients $CLIENTS --messages $MESSAGES --size $SIZE --json
+
+    kill $(cat server.pid)
+    wait $COUNTER 2> /dev/null
+    echo "$BACKEND syscalls: $(cat syscalls-$BACKEND.json 2> /dev/null || echo unavailable)"
+    rm -f server.pid
+done
@@ -0,0 +1,307 @@
+#include "content_filter.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+inline uint8_t foldCase(uint8_t byte) {
+    return (byte >= 'A' && byte <= 'Z') ? byte + ('a' - 'A') : byte;
+}
+
+} // namespace
+
+PatternMatcher::PatternMatcher(const std::vector<Rule>& inputRules) {
+    // Equivalence classes: every byte that occurs in a pattern gets its own
+    // class (upper and lower case share one), everything else is class 0
+    std::fill(std::begin(classOf), std::end(classOf), 0);
+    for (const auto& rule : inputRules) {
+        if (rule.pattern.empty() || rule.action == NONE) {
+            continue;
+        }
+        rules.push_back(rule);
+        longest = std::max(longest, rule.pattern.size());
+        for (unsigned char c : rule.pattern) {
+            uint8_t folded = foldCase(c);
+            if (classOf[folded] == 0) {
+                classOf[folded] = static_cast<uint8_t>(classes++);
+            }
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; ++c) {
+        classOf[c] = classOf[foldCase(static_cast<uint8_t>(c))];
+    }
+
+    // Trie of the patterns; missing edges are noRule until the DFA is completed
+    std::vector<uint32_t> trie(classes, noRule);
+    terminal.assign(1, noRule);
+    for (uint32_t r = 0; r < rules.size(); ++r) {
+        uint32_t state = 0;
+        for (unsigned char c : rules[r].pattern) {
+            uint32_t& next = trie[state * classes + classOf[c]];
+            if (next == noRule) {
+                next = static_cast<uint32_t>(terminal.size());
+                terminal.push_back(noRule);
+                trie.resize(trie.size() + classes, noRule);
+            }
+            state = trie[state * classes + classOf[c]];
+        }
+        // The same pattern listed twice keeps its strongest action
+        if (terminal[state] == noRule || rules[terminal[state]].action < rules[r].action) {
+            terminal[state] = r;
+        }
+    }
+
+    // Number the states breadth-first. A scan spends nearly all its time in
+    // the shallow states, which this keeps together at the start of the table.
+    size_t states = terminal.size();
+    std::vector<uint32_t> order(1, 0);      // new number -> trie state
+    std::vector<uint32_t> number(states, 0);
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (uint32_t c = 0; c < classes; ++c) {
+            uint32_t child = trie[order[i] * classes + c];
+            if (child != noRule) {
+                number[child] = static_cast<uint32_t>(order.size());
+                order.push_back(child);
+            }
+        }
+    }
+    std::vector<uint32_t> trieTerminal;
+    trieTerminal.swap(terminal);
+    terminal.resize(states);
+    for (size_t s = 0; s < states; ++s) {
+        terminal[s] = trieTerminal[order[s]];
+    }
+
+    // Rows are padded to a power of two, so finding one takes a shift
+    while ((1u << shift) < classes) {
+        shift++;
+    }
+    uint32_t stride = 1u << shift;
+
+    // Failure links, output links and the strongest action reachable through
+    // suffixes; missing edges are filled in from the failure state, which
+    // turns the trie into a DFA. In breadth-first order every state comes
+    // after its parent and its failure state, so one pass does it.
+    std::vector<uint32_t> next(states * stride, 0);
+    outputLink.assign(states, 0);
+    strongest.assign(states, NONE);
+    std::vector<uint32_t> fail(states, 0);
+
+    for (uint32_t c = 0; c < classes; ++c) {
+        uint32_t child = trie[c];
+        next[c] = child == noRule ? 0 : number[child];
+    }
+    for (uint32_t state = 1; state < states; ++state) {
+        uint32_t failure = fail[state];
+        outputLink[state] = terminal[failure] != noRule ? failure : outputLink[failure];
+        strongest[state] = std::max(terminal[state] != noRule ? rules[terminal[state]].action : NONE,
+                                    strongest[failure]);
+
+        for (uint32_t c = 0; c < classes; ++c) {
+            uint32_t child = trie[order[state] * classes + c];
+            uint32_t viaFailure = next[failure * stride + c];
+            if (child == noRule) {
+                next[state * stride + c] = viaFailure;
+            } else {
+                next[state * stride + c] = number[child];
+                fail[number[child]] = viaFailure;
+            }
+        }
+    }
+
+    // 16-bit entries halve the table, so a row of up to 32 classes is one
+    // cache line; only automatons too big for them keep 32-bit entries
+    if (states <= 0x10000) {
+        narrow.assign(next.begin(), next.end());
+    } else {
+        wide.swap(next);
+    }
+}
+
+PatternMatcher::Action PatternMatcher::scan(const char* text, size_t length, std::vector<Match>* matches) const {
+    if (!narrow.empty()) {
+        return scan(narrow.data(), text, length, matches);
+    }
+    return scan(wide.data(), text, length, matches);
+}
+
+template <typename Entry>
+PatternMatcher::Action PatternMatcher::scan(const Entry* table, const char* text, size_t length,
+                                             std::vector<Match>* matches) const {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text);
+    Action result = NONE;
+
+    // Looks at the state after byte i; false once nothing can outrank the result
+    auto output = [&](uint32_t state, size_t i) {
+        Action here = strongest[state];
+        if (here == REJECT) {
+            result = REJECT;
+            return false;
+        }
+        result = std::max(result, here);
+        if (matches && here == MASK) {
+            for (uint32_t s = terminal[state] != noRule ? state : outputLink[state];
+                 s != 0; s = outputLink[s]) {
+                if (rules[terminal[s]].action == MASK) {
+                    matches->push_back(Match{terminal[s], i + 1});
+                }
+            }
+        }
+        return true;
+    };
+
+    // One walk is a chain of dependent loads, one per byte, so the text is
+    // cut into quarters walked side by side. A walk that starts mid-text
+    // first reads the `longest` bytes before its quarter from the root: no
+    // state is deeper than the longest pattern, so that puts it in the same
+    // state a single walk would be in. Matches are only taken from a walk's
+    // own quarter. Walk 0 runs on past its quarter to keep the steps equal.
+    size_t quarter = length / 4;
+    uint32_t state = 0;
+    size_t done = 0;
+    if (quarter >= longest && quarter > 0) {
+        const uint8_t* first = bytes;
+        const uint8_t* second = bytes + quarter - longest;
+        const uint8_t* third = bytes + 2 * quarter - longest;
+        const uint8_t* fourth = bytes + 3 * quarter - longest;
+        uint32_t a = 0, b = 0, c = 0, d = 0;
+        for (size_t step = 0; step < quarter + longest; ++step) {
+            a = table[(a << shift) + classOf[first[step]]];
+            b = table[(b << shift) + classOf[second[step]]];
+            c = table[(c << shift) + classOf[third[step]]];
+            d = table[(d << shift) + classOf[fourth[step]]];
+            if ((strongest[a] | strongest[b] | strongest[c] | strongest[d]) == NONE) {
+                continue;
+            }
+            // Rare: some walk is in a state that ends a pattern
+            const uint32_t walk[4] = {a, b, c, d};
+            const size_t at[4] = {step, quarter - longest + step, 2 * quarter - longest + step,
+                                  3 * quarter - longest + step};
+            for (size_t w = 0; w < 4; ++w) {
+                if (strongest[walk[w]] != NONE && at[w] >= w * quarter && at[w] < (w + 1) * quarter &&
+                    !output(walk[w], at[w])) {
+                    return result;
+                }
+            }
+        }
+        // The last walk ended exactly where the remainder begins
+        state = d;
+        done = 4 * quarter;
+    }
+
+    for (size_t i = done; i < length; ++i) {
+        state = table[(state << shift) + classOf[bytes[i]]];
+        if (strongest[state] != NONE && !output(state, i)) {
+            return result;
+        }
+    }
+    return result;
+}
+
+const char* PatternMatcher::actionName(Action action) {
+    switch (action) {
+        case NONE: return "none";
+        case FLAG: return "flag";
+        case MASK: return "mask";
+        case REJECT: return "reject";
+        default: return "unknown";
+    }
+}
+
+bool ContentFilter::parseRules(const std::string& rulesPath, std::vector<PatternMatcher::Rule>& rules) {
+    std::ifstream file(rulesPath);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        size_t actionEnd = line.find_first_of(" \t", start);
+        size_t patternStart = actionEnd == std::string::npos ? std::string::npos
+                                                             : line.find_first_not_of(" \t", actionEnd);
+        if (patternStart == std::string::npos) {
+            LOG_WARNING("Content filter %s:%zu: expected '<action> <pattern>'", rulesPath.c_str(), lineNumber);
+            continue;
+        }
+
+        std::string action = line.substr(start, actionEnd - start);
+        PatternMatcher::Rule rule;
+        if (action == "reject") {
+            rule.action = PatternMatcher::REJECT;
+        } else if (action == "mask") {
+            rule.action = PatternMatcher::MASK;
+        } else if (action == "flag") {
+            rule.action = PatternMatcher::FLAG;
+        } else {
+            LOG_WARNING("Content filter %s:%zu: unknown action '%s'", rulesPath.c_str(), lineNumber, action.c_str());
+            continue;
+        }
+        rule.pattern = line.substr(patternStart);
+        rules.push_back(std::move(rule));
+    }
+    return true;
+}
+
+bool ContentFilter::load(const std::string& rulesPath) {
+    std::lock_guard<std::mutex> lock(loadMutex);
+
+    std::vector<PatternMatcher::Rule> rules;
+    if (!parseRules(rulesPath, rules)) {
+        LOG_ERROR("Content filter: cannot read %s, keeping the current rules", rulesPath.c_str());
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto compiled = std::make_shared<const PatternMatcher>(rules);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    path = rulesPath;
+    matcher.store(std::move(compiled));
+
+    auto active = matcher.load();
+    LOG_INFO("Content filter: %zu rules from %s, %zu states, %zu KB table, built in %lld ms",
+             active->ruleCount(), rulesPath.c_str(), active->stateCount(),
+             active->tableBytes() / 1024, static_cast<long long>(elapsed));
+    return true;
+}
+
+bool ContentFilter::reload() {
+    std::string rulesPath;
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        rulesPath = path;
+    }
+    return !rulesPath.empty() && load(rulesPath);
+}
+
+PatternMatcher::Action ContentFilter::apply(std::string& text) {
+    auto active = matcher.load();
+    if (!active) {
+        return PatternMatcher::NONE;
+    }
+
+    std::vector<PatternMatcher::Match> matches;
+    PatternMatcher::Action action = active->scan(text.data(), text.size(), &matches);
+    if (action == PatternMatcher::MASK) {
+        for (const auto& match : matches) {
+            size_t length = active->rule(match.rule).pattern.size();
+            std::fill(text.begin() + (match.end - length), text.begin() + match.end, '*');
+        }
+    }
+    return action;
+}
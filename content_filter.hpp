@@ -0,0 +1,110 @@
+#ifndef CONTENT_FILTER_HPP
+#define CONTENT_FILTER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Content filtering on the delivery path.
+//
+// Rules are loaded from a text file, one per line:
+//
+//     # comment
+//     reject  buy followers
+//     mask    badword
+//     flag    http://
+//
+// Matching is case-insensitive for ASCII and finds patterns anywhere in the
+// message. When several rules match, the strongest action wins:
+// reject (the sender gets an error) > mask (matches become '*') > flag
+// (delivered, but logged and counted).
+//
+// All patterns are compiled into one Aho-Corasick automaton, flattened into a
+// DFA: bytes map to a handful of equivalence classes and each state is a row
+// of next-state entries in a single table, so a message is scanned with one
+// table lookup per byte regardless of how many patterns there are. States are
+// numbered breadth-first and entries are 16 bits wide where they fit, which
+// keeps the rows a scan actually visits within a few dozen KB.
+//
+// The compiled automaton is immutable. A reload builds a new one off the
+// delivery path and publishes it with an atomic pointer swap; messages in
+// flight finish on the automaton they started with.
+
+class PatternMatcher {
+public:
+    enum Action : uint8_t { NONE = 0, FLAG = 1, MASK = 2, REJECT = 3 };
+
+    struct Rule {
+        Action action;
+        std::string pattern;
+    };
+
+    struct Match {
+        uint32_t rule;
+        size_t end;   // offset one past the last matched byte
+    };
+
+    explicit PatternMatcher(const std::vector<Rule>& rules);
+
+    // Strongest action among the rules matching text. Matches are collected
+    // only if the result calls for masking and matches is given.
+    Action scan(const char* text, size_t length, std::vector<Match>* matches = nullptr) const;
+
+    const Rule& rule(uint32_t index) const { return rules[index]; }
+    size_t ruleCount() const { return rules.size(); }
+    size_t stateCount() const { return terminal.size(); }
+    size_t tableBytes() const { return narrow.size() * sizeof(uint16_t) + wide.size() * sizeof(uint32_t); }
+
+    static const char* actionName(Action action);
+
+private:
+    static constexpr uint32_t noRule = UINT32_MAX;
+
+    template <typename Entry>
+    Action scan(const Entry* table, const char* text, size_t length, std::vector<Match>* matches) const;
+
+    std::vector<Rule> rules;
+    uint8_t classOf[256];
+    uint32_t classes = 1;
+    size_t longest = 0;                  // bytes in the longest pattern
+    uint32_t shift = 0;                  // log2 of the row length, classes rounded up
+    std::vector<uint16_t> narrow;        // [(state << shift) + class] -> next state, up to 65536 states
+    std::vector<uint32_t> wide;          // the same, for bigger automatons
+    std::vector<uint32_t> terminal;      // rule ending exactly at each state, or noRule
+    std::vector<uint32_t> outputLink;    // next state on the suffix chain that ends a rule
+    std::vector<Action> strongest;       // strongest action anywhere on the suffix chain
+};
+
+class ContentFilter {
+public:
+    static ContentFilter& getInstance() {
+        static ContentFilter instance;
+        return instance;
+    }
+
+    // Compiles the rules in path and swaps them in; on failure the current
+    // rules stay active
+    bool load(const std::string& rulesPath);
+    bool reload();
+
+    // Filters a message in place; returns what was done to it
+    PatternMatcher::Action apply(std::string& text);
+
+    std::shared_ptr<const PatternMatcher> current() const { return matcher.load(); }
+
+    static bool parseRules(const std::string& path, std::vector<PatternMatcher::Rule>& rules);
+
+private:
+    ContentFilter() = default;
+    ContentFilter(const ContentFilter&) = delete;
+    ContentFilter& operator=(const ContentFilter&) = delete;
+
+    std::mutex loadMutex;   // one build at a time
+    std::string path;
+    std::atomic<std::shared_ptr<const PatternMatcher>> matcher;
+};
+
+#endif // CONTENT_FILTER_HPP
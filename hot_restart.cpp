@@ -0,0 +1,548 @@
+#include "hot_restart.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "shm_ring.hpp"
+#include "wire.hpp"
+#include <cerrno>
+#include <future>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace {
+
+bool sendRecord(int fd, uint8_t type, const std::string& payload, int passFd = -1) {
+    std::string frame;
+    appendU32(frame, static_cast<uint32_t>(payload.size() + 1));
+    frame.push_back(static_cast<char>(type));
+    frame += payload;
+
+    iovec iov{frame.data(), frame.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    if (passFd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+    }
+
+    // The descriptor travels with the first chunk of the frame
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        sent += n;
+        iov.iov_base = frame.data() + sent;
+        iov.iov_len = frame.size() - sent;
+        msg.msg_control = nullptr;
+        msg.msg_controllen = 0;
+    }
+    return true;
+}
+
+bool recvFully(int fd, char* data, size_t length, int* receivedFd) {
+    while (length > 0) {
+        iovec iov{data, length};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int fdReceived;
+                std::memcpy(&fdReceived, CMSG_DATA(cmsg), sizeof(int));
+                if (receivedFd && *receivedFd < 0) {
+                    *receivedFd = fdReceived;
+                } else {
+                    ::close(fdReceived);
+                }
+            }
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool recvRecord(int fd, uint8_t& type, std::string& payload, int& receivedFd) {
+    receivedFd = -1;
+    char header[5];
+    if (!recvFully(fd, header, sizeof(header), &receivedFd)) {
+        return false;
+    }
+    uint32_t length = static_cast<uint32_t>(readLE(header, 4));
+    if (length == 0) {
+        return false;
+    }
+    type = static_cast<uint8_t>(header[4]);
+    payload.resize(length - 1);
+    return payload.empty() || recvFully(fd, &payload[0], payload.size(), nullptr);
+}
+
+uint64_t doubleBits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bitsDouble(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Runs f where session's handlers run and returns what it returns. Sessions
+// of a listener with its own workers live on one of its threads; the caller
+// waits for them.
+template <typename F>
+auto inSession(const std::shared_ptr<Session>& session, F f) -> decltype(f()) {
+    if (session->inSessionThread()) {
+        return f();
+    }
+    std::packaged_task<decltype(f())()> task(std::move(f));
+    auto result = task.get_future();
+    boost::asio::post(session->getExecutor(), [&task]() { task(); });
+    return result.get();
+}
+
+} // namespace
+
+int HandoverState::takeListener(const std::string& role) {
+    for (auto it = listeners.begin(); it != listeners.end(); ++it) {
+        if (it->role == role) {
+            int fd = it->fd;
+            listeners.erase(it);
+            return fd;
+        }
+    }
+    return -1;
+}
+
+HotRestart::HotRestart(boost::asio::io_context& ioContext, Room& r):
+    io(ioContext),
+    room(r) {}
+
+uint64_t HotRestart::nowNs() {
+    // CLOCK_MONOTONIC is shared by both processes, so timestamps cross the handover
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool HotRestart::takeover(const std::string& controlPath, HandoverState& state) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, controlPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    const std::string request = "TAKEOVER\n";
+    if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        ::close(fd);
+        return false;
+    }
+
+    HandoverState received;
+    bool complete = false;
+    uint8_t type;
+    std::string payload;
+    int passedFd;
+    while (!complete && recvRecord(fd, type, payload, passedFd)) {
+        WireReader reader(payload.data(), payload.size());
+        switch (type) {
+            case LISTENER:
+                received.listeners.push_back({reader.readString(), passedFd});
+                break;
+            case SESSION: {
+                HandoverState::SessionRecord record;
+                record.fd = passedFd;
+                record.session.clientId = reader.readString();
+                record.session.pendingInput = reader.readString();
+                uint32_t count = static_cast<uint32_t>(reader.readInt(4));
+                for (uint32_t i = 0; i < count && reader.ok(); ++i) {
+                    record.session.pendingOutput.push_back(reader.readString());
+                }
+                record.hasRateLimit = reader.readInt(1) != 0;
+                if (record.hasRateLimit) {
+                    record.rateLimit.tokensAvailable = bitsDouble(reader.readInt(8));
+                    record.rateLimit.secondsSinceLastRequest = bitsDouble(reader.readInt(8));
+                    record.rateLimit.messageCount = static_cast<int>(reader.readInt(4));
+                    record.rateLimit.rateLimitExceeded = static_cast<int>(reader.readInt(4));
+                }
+                record.pausedAtNs = reader.readInt(8);
+                if (!reader.atEnd()) {
+                    record.session.nick = reader.readString();
+                }
+                if (!reader.atEnd()) {
+                    record.session.listener = reader.readString();
+                }
+                received.sessions.push_back(std::move(record));
+                break;
+            }
+            case SHM:
+                received.shmChannels.push_back(reader.readString());
+                break;
+            case HISTORY: {
+                uint32_t count = static_cast<uint32_t>(reader.readInt(4));
+                for (uint32_t i = 0; i < count && reader.ok(); ++i) {
+                    received.history.push_back(reader.readString());
+                }
+                break;
+            }
+            case END:
+                complete = true;
+                break;
+            default:
+                reader.readInt(payload.size() + 1);
+                break;
+        }
+        if (!reader.ok() || (type != LISTENER && type != SESSION && passedFd >= 0)) {
+            if (passedFd >= 0) ::close(passedFd);
+            break;
+        }
+    }
+
+    if (complete) {
+        const std::string ok = "OK\n";
+        complete = ::send(fd, ok.data(), ok.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(ok.size());
+    }
+    ::close(fd);
+
+    if (!complete) {
+        // The old process keeps serving; drop whatever we were given
+        for (const auto& listener : received.listeners) ::close(listener.fd);
+        for (const auto& session : received.sessions) ::close(session.fd);
+        LOG_ERROR("Hot restart: incomplete handover from %s", controlPath.c_str());
+        return false;
+    }
+
+    LOG_INFO("Hot restart: received %zu listeners, %zu sessions, %zu shm channels",
+             received.listeners.size(), received.sessions.size(), received.shmChannels.size());
+    state = std::move(received);
+    return true;
+}
+
+void HotRestart::restore(HandoverState& state, const ListenerLookup& findListener) {
+    room.restoreHistory(state.history);
+
+    for (auto& record : state.sessions) {
+        sockaddr_storage addr{};
+        socklen_t length = sizeof(addr);
+        if (::getsockname(record.fd, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+            ::close(record.fd);
+            continue;
+        }
+        int family = addr.ss_family;
+        Listener* listener = findListener(record.session.listener);
+        Session::Socket socket(listener ? listener->sessionExecutor() : io.get_executor(),
+                               boost::asio::generic::stream_protocol(family, family == AF_UNIX ? 0 : IPPROTO_TCP),
+                               record.fd);
+
+        if (record.hasRateLimit) {
+            RateLimiter::getInstance().importClient(record.session.clientId, record.rateLimit);
+        }
+
+        auto session = listener
+            ? std::make_shared<Session>(std::move(socket), room, record.session, listener->getProfile())
+            : std::make_shared<Session>(std::move(socket), room, record.session);
+        session->start();
+
+        // Time this client went without being served
+        MetricsCollector::getInstance().recordMetric("hot_restart_session_pause",
+                                                     (nowNs() - record.pausedAtNs) / 1000.0);
+    }
+
+    for (const auto& name : state.shmChannels) {
+        auto channel = ShmChannel::open(name);
+        if (!channel) {
+            LOG_ERROR("Hot restart: cannot reopen shared memory channel %s", name.c_str());
+            continue;
+        }
+        channel->setOwner(true);
+        std::make_shared<ShmSession>(io, std::move(channel), room)->start();
+    }
+
+    if (!state.sessions.empty()) {
+        auto stats = MetricsCollector::getInstance().getStats("hot_restart_session_pause");
+        LOG_INFO("Hot restart: resumed %zu sessions, pause avg %.0f us, p99 %.0f us, max %.0f us",
+                 state.sessions.size(), stats.avg, stats.p99, stats.max);
+    }
+    state.sessions.clear();
+    state.shmChannels.clear();
+}
+
+void HotRestart::listen(const std::string& controlPath) {
+    ::unlink(controlPath.c_str());
+    controlAcceptor = std::make_unique<boost::asio::local::stream_protocol::acceptor>(
+        io, boost::asio::local::stream_protocol::endpoint(controlPath));
+    // Connecting takes write permission; whoever slips in before this is
+    // turned away by the credentials check in accept_control()
+    if (::chmod(controlPath.c_str(), S_IRUSR | S_IWUSR) != 0) {
+        LOG_WARNING("Hot restart: cannot restrict %s to its owner: %s", controlPath.c_str(), std::strerror(errno));
+    }
+    accept_control();
+    LOG_INFO("Hot restart control socket at %s", controlPath.c_str());
+}
+
+void HotRestart::addListener(HandoverListener listener) {
+    listeners.push_back(std::move(listener));
+}
+
+void HotRestart::accept_control() {
+    controlAcceptor->async_accept([this](boost::system::error_code ec, ControlSocket socket) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        ucred peer{};
+        socklen_t length = sizeof(peer);
+        if (!ec && (::getsockopt(socket.native_handle(), SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 ||
+                    peer.uid != ::geteuid())) {
+            LOG_WARNING("Hot restart: refused a control connection from uid %u (pid %d)",
+                        static_cast<unsigned>(peer.uid), static_cast<int>(peer.pid));
+            MetricsCollector::getInstance().recordMetric("control_refused", 1);
+        } else if (!ec) {
+            serveControl(std::make_shared<ControlSocket>(std::move(socket)),
+                         std::make_shared<boost::asio::streambuf>());
+        }
+        accept_control();
+    });
+}
+
+void HotRestart::setCommandHandler(CommandHandler handler, boost::asio::any_io_executor executor) {
+    commandHandler = std::move(handler);
+    commandExecutor = std::move(executor);
+}
+
+void HotRestart::serveControl(std::shared_ptr<ControlSocket> control, std::shared_ptr<boost::asio::streambuf> request) {
+    boost::asio::async_read_until(*control, *request, "\n",
+        [this, control, request](boost::system::error_code ec, std::size_t length) {
+            if (ec) return;
+            std::string line(boost::asio::buffers_begin(request->data()),
+                             boost::asio::buffers_begin(request->data()) + length);
+            request->consume(length);
+            if (line == "TAKEOVER\n") {
+                if (!inProgress) {
+                    beginHandover(control);
+                }
+                return;
+            }
+            if (!commandHandler) {
+                return;
+            }
+            
+            // Admin commands may take a while (RELOAD reads the config
+            // file), so they run off the event loop
+            line.pop_back();
+            boost::asio::post(commandExecutor, [this, control, request, line]() {
+                auto reply = std::make_shared<std::string>(commandHandler(line));
+                boost::asio::post(io, [this, control, request, reply]() {
+                    boost::asio::async_write(*control, boost::asio::buffer(*reply),
+                        [this, control, request, reply](boost::system::error_code ec, std::size_t) {
+                            if (!ec) {
+                                serveControl(control, request);
+                            }
+                        });
+                });
+            });
+        });
+}
+
+void HotRestart::beginHandover(std::shared_ptr<ControlSocket> control) {
+    LOG_INFO("Hot restart: takeover requested, pausing sessions");
+    inProgress = true;
+    handoverStart = std::chrono::steady_clock::now();
+
+    for (auto& listener : listeners) {
+        listener.pause();
+    }
+
+    sessions.clear();
+    shmSessions.clear();
+    for (const auto& participant : room.getParticipants()) {
+        if (auto session = std::dynamic_pointer_cast<Session>(participant)) {
+            inSession(session, [&session]() { session->pause(); });
+            sessions.push_back(session);
+        } else if (auto shmSession = std::dynamic_pointer_cast<ShmSession>(participant)) {
+            shmSession->pause();
+            shmSessions.push_back(shmSession);
+        }
+    }
+
+    // Nothing produces output any more. What workers posted to sessions on
+    // the main loop before their sessions paused, shared-memory sessions
+    // included, is queued ahead of this, so it is in those sessions' queues
+    // (or rings) before any state is exported.
+    writesCancelled = false;
+    drainTimer = std::make_unique<boost::asio::steady_timer>(io);
+    boost::asio::post(io, [this, control]() { waitForWrites(control); });
+}
+
+void HotRestart::waitForWrites(std::shared_ptr<ControlSocket> control) {
+    bool writing = false;
+    for (const auto& session : sessions) {
+        writing = writing || inSession(session, [&session]() { return session->isWriting(); });
+    }
+
+    // Writes that are still stuck after the timeout are cancelled; what they
+    // did not send stays queued and is handed over with the session
+    auto elapsed = std::chrono::steady_clock::now() - handoverStart;
+    if (writing && elapsed >= std::chrono::milliseconds(drainTimeoutMs) && !writesCancelled) {
+        size_t stuck = 0;
+        for (const auto& session : sessions) {
+            stuck += inSession(session, [&session]() {
+                if (!session->isWriting()) {
+                    return 0;
+                }
+                session->cancelWrite();
+                return 1;
+            });
+        }
+        writesCancelled = true;
+        LOG_WARNING("Hot restart: cancelling %zu writes still in flight after %d ms",
+                    stuck, static_cast<int>(drainTimeoutMs));
+    }
+    if (writing) {
+        drainTimer->expires_after(std::chrono::milliseconds(1));
+        drainTimer->async_wait([this, control](const boost::system::error_code& ec) {
+            if (!ec) waitForWrites(control);
+        });
+        return;
+    }
+
+    // The transfer is a short burst of local I/O; do it synchronously so no
+    // handler can touch the sessions halfway through
+    boost::system::error_code ec;
+    control->native_non_blocking(false, ec);
+    control->non_blocking(false, ec);
+    if (transfer(control->native_handle())) {
+        finish();
+    } else {
+        LOG_ERROR("Hot restart: handover failed, resuming service");
+        abort();
+    }
+}
+
+bool HotRestart::transfer(int fd) {
+    for (const auto& listener : listeners) {
+        std::string payload;
+        appendString(payload, listener.role);
+        if (!sendRecord(fd, LISTENER, payload, listener.nativeHandle())) return false;
+    }
+
+    // Broadcasts still waiting for the batch tick join the sessions' pending output
+    room.flush();
+
+    uint64_t pausedAtNs = nowNs();
+    transferred.clear();
+    for (const auto& session : sessions) {
+        // A worker session's strand runs what was posted to it first, the
+        // batch flushed above included
+        SessionState state = inSession(session, [&session]() { return session->exportState(); });
+        std::string payload;
+        appendString(payload, state.clientId);
+        appendString(payload, state.pendingInput);
+        appendU32(payload, static_cast<uint32_t>(state.pendingOutput.size()));
+        for (const auto& output : state.pendingOutput) {
+            appendString(payload, output);
+        }
+
+        RateLimiter::ClientState rateLimit;
+        bool hasRateLimit = RateLimiter::getInstance().exportClient(state.clientId, rateLimit);
+        payload.push_back(hasRateLimit ? 1 : 0);
+        if (hasRateLimit) {
+            appendU64(payload, doubleBits(rateLimit.tokensAvailable));
+            appendU64(payload, doubleBits(rateLimit.secondsSinceLastRequest));
+            appendU32(payload, static_cast<uint32_t>(rateLimit.messageCount));
+            appendU32(payload, static_cast<uint32_t>(rateLimit.rateLimitExceeded));
+        }
+        appendU64(payload, pausedAtNs);
+        appendString(payload, state.nick);
+        appendString(payload, state.listener);
+
+        if (!sendRecord(fd, SESSION, payload, session->nativeHandle())) return false;
+        transferred.push_back(session);
+    }
+
+    for (const auto& shmSession : shmSessions) {
+        std::string payload;
+        appendString(payload, shmSession->getChannelName());
+        if (!sendRecord(fd, SHM, payload)) return false;
+    }
+
+    std::vector<std::string> history = room.getHistory();
+    std::string payload;
+    appendU32(payload, static_cast<uint32_t>(history.size()));
+    for (const auto& body : history) {
+        appendString(payload, body);
+    }
+    if (!sendRecord(fd, HISTORY, payload) || !sendRecord(fd, END, std::string())) {
+        return false;
+    }
+
+    // Wait for the new process to confirm it holds everything
+    timeval timeout{5, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char reply[3];
+    return recvFully(fd, reply, sizeof(reply), nullptr) && std::string(reply, 3) == "OK\n";
+}
+
+void HotRestart::finish() {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - handoverStart).count();
+    LOG_INFO("Hot restart: handed over %zu sessions in %lld ms, exiting",
+             transferred.size(), static_cast<long long>(elapsed));
+
+    for (auto& listener : listeners) {
+        listener.close();
+    }
+    // Only the sessions whose descriptor the new process holds; closing any
+    // other would drop its client
+    for (const auto& session : transferred) {
+        inSession(session, [&session]() { session->finishHandover(); });
+    }
+    for (const auto& shmSession : shmSessions) {
+        shmSession->finishHandover();
+    }
+    sessions.clear();
+    transferred.clear();
+    shmSessions.clear();
+
+    boost::system::error_code ec;
+    controlAcceptor->close(ec);
+    io.stop();
+}
+
+void HotRestart::abort() {
+    for (const auto& session : sessions) {
+        inSession(session, [&session]() { session->resume(); });
+    }
+    for (const auto& shmSession : shmSessions) {
+        shmSession->resume();
+    }
+    for (auto& listener : listeners) {
+        listener.resume();
+    }
+    sessions.clear();
+    transferred.clear();
+    shmSessions.clear();
+    inProgress = false;
+}
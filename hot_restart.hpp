@@ -0,0 +1,139 @@
+#ifndef HOT_RESTART_HPP
+#define HOT_RESTART_HPP
+
+#include "chatroom.hpp"
+#include "listener.hpp"
+#include "rate_limiter.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+#include <boost/asio/local/stream_protocol.hpp>
+
+// Zero-downtime restart.
+//
+// A running server listens on a control Unix socket (--control <path>), which
+// also takes admin commands (see runtime_config.hpp). Only the server's own
+// user may use it: the socket file is mode 0600 and every connection's peer
+// credentials are checked. A new process started
+// with --takeover <path> connects and sends "TAKEOVER\n".
+// The old process stops accepting, pauses every session, waits for in-flight
+// writes to finish (cancelling those still going after drainTimeoutMs; their
+// unsent bytes stay queued) and then streams its state as records, passing
+// descriptors along with SCM_RIGHTS:
+//
+//     LISTENER  role                                   + listening socket
+//     SESSION   clientId | pending input | pending output |
+//               rate-limit bucket | pause timestamp |
+//               nickname | listener name               + connection socket
+//     SHM       channel name
+//     HISTORY   room history
+//     END
+//
+// Each record is framed as u32 length (of type + payload) | u8 type | payload.
+// The new process answers "OK\n" once it holds everything; the old process
+// then closes its copies of the descriptors (which sends no FIN while the new
+// process holds them) and exits. Connections that arrive meanwhile wait in
+// the listen backlog. If the new process never confirms, the old one resumes.
+//
+// Sessions of a listener with its own workers are handed over as well: each
+// step that touches one runs on its strand while the main loop waits, and
+// the new process continues it on the same listener's workers.
+
+struct HandoverState {
+    struct Listener {
+        std::string role;
+        int fd;
+    };
+
+    struct SessionRecord {
+        SessionState session;
+        bool hasRateLimit = false;
+        RateLimiter::ClientState rateLimit;
+        uint64_t pausedAtNs = 0;
+        int fd = -1;
+    };
+
+    std::vector<Listener> listeners;
+    std::vector<SessionRecord> sessions;
+    std::vector<std::string> shmChannels;
+    std::vector<std::string> history;
+
+    // Takes ownership of a handed-over listening socket; -1 if none was received
+    int takeListener(const std::string& role);
+};
+
+// A listening socket the old process gives up during a handover
+struct HandoverListener {
+    std::string role;
+    std::function<int()> nativeHandle;
+    std::function<void()> pause;   // stop accepting
+    std::function<void()> resume;  // start accepting again after a failed handover
+    std::function<void()> close;
+};
+
+class HotRestart {
+    public:
+        enum RecordType : uint8_t {
+            LISTENER = 1,
+            SESSION = 2,
+            SHM = 3,
+            HISTORY = 4,
+            END = 5
+        };
+
+        // Longest the old process waits for in-flight writes before cancelling them
+        enum {drainTimeoutMs = 2000};
+
+        HotRestart(boost::asio::io_context& io, Room& room);
+
+        // New process: fetch listeners, sessions and room state from the server
+        // at controlPath. Returns false, having taken nothing, if none answered.
+        static bool takeover(const std::string& controlPath, HandoverState& state);
+
+        // Where a restored session continues, by the name of the listener it
+        // came in on; nullptr if this process has no such listener
+        typedef std::function<Listener*(const std::string&)> ListenerLookup;
+
+        // New process: continue the handed-over sessions, channels and history
+        void restore(HandoverState& state, const ListenerLookup& findListener);
+
+        // Old process: serve takeover requests on controlPath
+        void listen(const std::string& controlPath);
+        void addListener(HandoverListener listener);
+        
+        // Any other line on the control socket is passed to handler (without
+        // its newline), run by executor (meant to be off the event loop, and
+        // to go away before this does); what it returns is the reply
+        typedef std::function<std::string(const std::string&)> CommandHandler;
+        void setCommandHandler(CommandHandler handler, boost::asio::any_io_executor executor);
+
+        static uint64_t nowNs();
+    private:
+        typedef boost::asio::local::stream_protocol::socket ControlSocket;
+
+        void accept_control();
+        // Reads control lines one at a time until a takeover or the peer closes
+        void serveControl(std::shared_ptr<ControlSocket> control, std::shared_ptr<boost::asio::streambuf> request);
+        void beginHandover(std::shared_ptr<ControlSocket> control);
+        void waitForWrites(std::shared_ptr<ControlSocket> control);
+        bool transfer(int fd);
+        void finish();
+        void abort();
+
+        boost::asio::io_context& io;
+        Room& room;
+        std::unique_ptr<boost::asio::local::stream_protocol::acceptor> controlAcceptor;
+        std::vector<HandoverListener> listeners;
+        CommandHandler commandHandler;
+        boost::asio::any_io_executor commandExecutor;
+
+        bool inProgress = false;
+        bool writesCancelled = false;
+        std::chrono::steady_clock::time_point handoverStart;
+        std::vector<std::shared_ptr<Session>> sessions;
+        std::vector<std::shared_ptr<Session>> transferred;   // sessions the new process received
+        std::vector<std::shared_ptr<ShmSession>> shmSessions;
+        std::unique_ptr<boost::asio::steady_timer> drainTimer;
+};
+
+#endif // HOT_RESTART_HPP
@@ -0,0 +1,245 @@
+#include "ingest.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INGEST_X86 1
+#endif
+
+namespace {
+
+inline bool isControl(uint8_t byte) {
+    return (byte < 0x20 && byte != '\t') || byte == 0x7F;
+}
+
+// One byte of the UTF-8 state machine (Unicode Table 3-7, well-formed sequences)
+inline void utf8Step(IngestScanner::State& state, uint8_t byte) {
+    if (state.need == 0) {
+        if (byte < 0x80) {
+            return;
+        }
+        if (byte < 0xC2) {
+            state.invalid = true;
+        } else if (byte < 0xE0) {
+            state.need = 1;
+        } else if (byte < 0xF0) {
+            state.need = 2;
+            state.lower = byte == 0xE0 ? 0xA0 : 0x80;   // no overlong forms
+            state.upper = byte == 0xED ? 0x9F : 0xBF;   // no surrogates
+        } else if (byte < 0xF5) {
+            state.need = 3;
+            state.lower = byte == 0xF0 ? 0x90 : 0x80;
+            state.upper = byte == 0xF4 ? 0x8F : 0xBF;   // nothing above U+10FFFF
+        } else {
+            state.invalid = true;
+        }
+        return;
+    }
+
+    if (byte < state.lower || byte > state.upper) {
+        state.invalid = true;
+        state.need = 0;
+    } else {
+        state.need--;
+    }
+    state.lower = 0x80;
+    state.upper = 0xBF;
+}
+
+// Bytes [begin, stop) of a block with multi-byte sequences in it. `high`
+// marks the bytes >= 0x80 (bit n is data[begin + n]), so ASCII runs between
+// sequences are skipped rather than stepped through.
+inline void utf8Block(const uint8_t* data, size_t begin, size_t stop, uint32_t high,
+                      IngestScanner::State& state) {
+    size_t i = begin;
+    for (;;) {
+        // Finish the open sequence; a byte that is not a continuation ends it as invalid
+        while (state.need && i < stop) {
+            utf8Step(state, data[i++]);
+        }
+        uint32_t ahead = i - begin < 32 ? high & (~0u << (i - begin)) : 0;
+        if (!ahead) {
+            return;
+        }
+        i = begin + __builtin_ctz(ahead);
+        if (i >= stop) {
+            return;
+        }
+        utf8Step(state, data[i++]);
+    }
+}
+
+size_t scanScalar(const uint8_t* data, size_t i, size_t end, IngestScanner::State& state) {
+    for (; i < end; ++i) {
+        uint8_t byte = data[i];
+        if (byte == '\n') {
+            return i;
+        }
+        if (isControl(byte)) {
+            state.controls++;
+        }
+        if (byte >= 0x80 || state.need) {
+            utf8Step(state, byte);
+        }
+    }
+    return end;
+}
+
+#ifdef INGEST_X86
+
+size_t scanSSE2(const uint8_t* data, size_t i, size_t end, IngestScanner::State& state) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i tab = _mm_set1_epi8('\t');
+
+    for (; i + 16 <= end; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t lines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        uint32_t high = _mm_movemask_epi8(v);
+        // Signed compare: bytes >= 0x80 are negative and also "below" space
+        uint32_t controls = (_mm_movemask_epi8(_mm_cmpgt_epi8(space, v)) & ~high) |
+                            _mm_movemask_epi8(_mm_cmpeq_epi8(v, del));
+        controls &= ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, tab)));
+
+        uint32_t before = 0xFFFF;
+        size_t stop = i + 16;
+        if (lines) {
+            unsigned at = __builtin_ctz(lines);
+            before = (1u << at) - 1;
+            stop = i + at;
+        }
+        state.controls += __builtin_popcount(controls & before);
+        if ((high & before) || state.need) {
+            utf8Block(data, i, stop, high, state);
+        }
+        if (lines) {
+            return stop;
+        }
+    }
+    return scanScalar(data, i, end, state);
+}
+
+__attribute__((target("avx2")))
+size_t scanAVX2(const uint8_t* data, size_t i, size_t end, IngestScanner::State& state) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    const __m256i tab = _mm256_set1_epi8('\t');
+
+    for (; i + 32 <= end; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t lines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        uint32_t high = _mm256_movemask_epi8(v);
+        uint32_t controls = (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(space, v))) & ~high) |
+                            static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, del)));
+        controls &= ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, tab)));
+
+        uint32_t before = 0xFFFFFFFFu;
+        size_t stop = i + 32;
+        if (lines) {
+            unsigned at = __builtin_ctz(lines);
+            before = (1u << at) - 1;
+            stop = i + at;
+        }
+        state.controls += __builtin_popcount(controls & before);
+        if ((high & before) || state.need) {
+            utf8Block(data, i, stop, high, state);
+        }
+        if (lines) {
+            return stop;
+        }
+    }
+    return scanSSE2(data, i, end, state);
+}
+
+#endif // INGEST_X86
+
+} // namespace
+
+size_t IngestScanner::scan(const char* data, size_t size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t found;
+    switch (kernel) {
+#ifdef INGEST_X86
+        case AVX2:
+            found = scanAVX2(bytes, scanned, size, state);
+            break;
+        case SSE2:
+            found = scanSSE2(bytes, scanned, size, state);
+            break;
+#endif
+        default:
+            found = scanScalar(bytes, scanned, size, state);
+            break;
+    }
+
+    scanned = found;
+    return found < size ? found : npos;
+}
+
+IngestScanner::Verdict IngestScanner::verdict(const char* data, size_t newline) const {
+    if (state.invalid || state.need) {
+        return LINE_INVALID_UTF8;
+    }
+    size_t controls = state.controls;
+    if (newline > 0 && data[newline - 1] == '\r') {
+        controls--;
+    }
+    return controls ? LINE_HAS_CONTROLS : LINE_OK;
+}
+
+IngestScanner::Verdict IngestScanner::classify(const char* data, size_t size) {
+    IngestScanner scanner;
+    size_t newlines = 0;
+    while (scanner.scan(data, size) != npos) {
+        newlines++;
+        scanner.scanned++;
+    }
+    if (scanner.state.invalid || scanner.state.need) {
+        return LINE_INVALID_UTF8;
+    }
+    return scanner.state.controls + newlines ? LINE_HAS_CONTROLS : LINE_OK;
+}
+
+std::string IngestScanner::stripControls(const char* data, size_t size) {
+    std::string result;
+    result.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        if (!isControl(static_cast<uint8_t>(data[i]))) {
+            result.push_back(data[i]);
+        }
+    }
+    return result;
+}
+
+size_t IngestScanner::utf8Prefix(const char* data, size_t size, size_t maxBytes) {
+    if (size <= maxBytes) {
+        return size;
+    }
+    // Back up over continuation bytes to the start of the sequence that would be cut
+    size_t length = maxBytes;
+    while (length > 0 && (static_cast<uint8_t>(data[length]) & 0xC0) == 0x80) {
+        length--;
+    }
+    return length;
+}
+
+IngestScanner::Kernel IngestScanner::bestKernel() {
+#ifdef INGEST_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return AVX2;
+    }
+    return SSE2;
+#else
+    return SCALAR;
+#endif
+}
+
+const char* IngestScanner::kernelName(Kernel kernel) {
+    switch (kernel) {
+        case SCALAR: return "scalar";
+        case SSE2: return "sse2";
+        case AVX2: return "avx2";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef INGEST_HPP
+#define INGEST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Single-pass scanner for inbound client text.
+//
+// Each call to scan() walks only bytes it has not seen before and, in the
+// same pass, finds the next '\n', validates UTF-8 (rejecting overlong forms,
+// surrogates and code points above U+10FFFF) and counts control characters
+// (C0 and DEL). A line that is split across reads keeps its validation state
+// until its newline arrives, so no byte is looked at twice.
+//
+// Blocks of pure ASCII are classified 32 bytes (AVX2) or 16 bytes (SSE2) at
+// a time; only blocks holding multi-byte sequences go through the scalar
+// UTF-8 state machine. The kernel is picked once at start-up from what the
+// CPU supports, and can be forced for benchmarking.
+class IngestScanner {
+public:
+    enum Kernel { SCALAR, SSE2, AVX2 };
+
+    // What happens to a line containing control characters
+    enum ControlPolicy { STRIP_CONTROLS, REJECT_CONTROLS };
+
+    enum Verdict {
+        LINE_OK,             // forward as is
+        LINE_HAS_CONTROLS,   // valid UTF-8, but control characters need stripping
+        LINE_INVALID_UTF8
+    };
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    IngestScanner() : kernel(bestKernel()) {}
+    explicit IngestScanner(Kernel kernel) : kernel(kernel) {}
+
+    // Scans data[0, size) from where the previous call stopped. Returns the
+    // offset of the next '\n', or npos if the line is not complete yet.
+    size_t scan(const char* data, size_t size);
+
+    // Verdict for the line ended by the '\n' scan() just returned; a '\r'
+    // right before it is part of the line ending, not a control character
+    Verdict verdict(const char* data, size_t newline) const;
+
+    // Forget the current line; call after consuming it
+    void reset() {
+        scanned = 0;
+        state = State{};
+    }
+
+    // Verdict for a complete message that is not line-delimited (a binary
+    // frame body); any '\n' in it counts as a control character
+    static Verdict classify(const char* data, size_t size);
+
+    // Copies text without its control characters (tab is kept)
+    static std::string stripControls(const char* data, size_t size);
+
+    // Longest prefix of at most maxBytes that does not split a UTF-8 sequence
+    static size_t utf8Prefix(const char* data, size_t size, size_t maxBytes);
+
+    static Kernel bestKernel();
+    static const char* kernelName(Kernel kernel);
+
+    // Scanner state carried across reads of one line
+    struct State {
+        size_t controls = 0;      // control characters seen
+        uint8_t need = 0;         // continuation bytes still expected
+        uint8_t lower = 0x80;     // allowed range of the next continuation byte
+        uint8_t upper = 0xBF;
+        bool invalid = false;
+    };
+
+private:
+    Kernel kernel;
+    size_t scanned = 0;
+    State state;
+};
+
+#endif // INGEST_HPP
@@ -0,0 +1,78 @@
+#ifndef IO_BACKEND_HPP
+#define IO_BACKEND_HPP
+
+#include "uring_loop.hpp"
+#include "logger.hpp"
+#include <memory>
+#include <string>
+#include <typeinfo>
+
+// The networking backend is chosen at startup (--io-backend):
+//
+//     auto       io_uring if the kernel supports everything used, else epoll (default)
+//     io_uring   the same, but falling back to epoll is logged as a warning
+//     epoll      asio's reactor for every socket
+//
+// With io_uring, the listeners and sessions served by the main event loop
+// accept, receive and send through a UringLoop (see uring_loop.hpp); timers,
+// signals and everything else stay with asio. Listeners with their own
+// workers, the cluster links and the control socket always use epoll.
+// Whether io_uring is usable is found out by trying it, so a kernel that is
+// too old, or a sandbox that blocks the system calls, ends up on epoll.
+class IoBackend {
+    public:
+        enum Mode {AUTO, EPOLL, IO_URING};
+
+        static bool parseMode(const std::string& text, Mode& mode) {
+            if (text == "auto") {
+                mode = AUTO;
+            } else if (text == "epoll") {
+                mode = EPOLL;
+            } else if (text == "io_uring") {
+                mode = IO_URING;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        // Must go before mainLoop does; sessions are served by epoll again afterwards
+        IoBackend(boost::asio::io_context& mainLoop, Mode mode) {
+            if (mode != EPOLL) {
+                std::string reason;
+                ring = UringLoop::create(mainLoop, reason);
+                if (!ring && mode == IO_URING) {
+                    LOG_WARNING("io_uring unavailable (%s), falling back to epoll", reason.c_str());
+                } else if (!ring) {
+                    LOG_INFO("io_uring unavailable (%s), using epoll", reason.c_str());
+                }
+            }
+            active = this;
+        }
+
+        ~IoBackend() {
+            active = nullptr;
+        }
+
+        const char* name() const {
+            return ring ? "io_uring" : "epoll";
+        }
+
+        // The ring that serves sockets running on executor; nullptr for epoll,
+        // which includes every executor but the main loop's own
+        static UringLoop* ringFor(const boost::asio::any_io_executor& executor) {
+            typedef boost::asio::io_context::executor_type LoopExecutor;
+            // target() does not check the type in this Boost version; target_type() does
+            if (!active || !active->ring || executor.target_type() != typeid(LoopExecutor)) {
+                return nullptr;
+            }
+            auto& context = executor.target<LoopExecutor>()->context();
+            return &context == &active->ring->context() ? active->ring.get() : nullptr;
+        }
+
+    private:
+        std::unique_ptr<UringLoop> ring;
+        static inline IoBackend* active = nullptr;
+};
+
+#endif // IO_BACKEND_HPP
@@ -0,0 +1,314 @@
+#include "listener.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "load_shedder.hpp"
+#include "io_backend.hpp"
+#include <future>
+#include <sstream>
+#include <sys/un.h>
+
+namespace {
+
+// Whole string as a decimal number from 0 to max, or false
+bool toCount(const std::string& value, unsigned long max, unsigned& count) {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || value.size() > 9) {
+        return false;
+    }
+    unsigned long number = std::strtoul(value.c_str(), nullptr, 10);
+    if (number > max) {
+        return false;
+    }
+    count = static_cast<unsigned>(number);
+    return true;
+}
+
+} // namespace
+
+bool ListenerConfig::parse(const std::string& spec, ListenerConfig& config, std::string& error) {
+    std::stringstream fields(spec);
+    std::string address;
+    std::getline(fields, address, ',');
+
+    // A bare port listens on every IPv4 address
+    if (!address.empty() && address.find_first_not_of("0123456789") == std::string::npos) {
+        address = ":" + address;
+    }
+    if (!ClusterAddress::parse(address, config.address)) {
+        error = "invalid address '" + address + "'";
+        return false;
+    }
+
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        size_t equals = field.find('=');
+        std::string key = field.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+        unsigned count = 0;
+        if (value.empty()) {
+            error = "expected key=value, got '" + field + "'";
+            return false;
+        }
+
+        if (key == "name") {
+            config.name = value;
+        } else if (key == "workers" && toCount(value, maxWorkers, count)) {
+            config.workers = count;
+        } else if (key == "mode" && (value == "newline" || value == "binary")) {
+            config.framing = value == "binary" ? SessionProfile::BINARY : SessionProfile::NEWLINE;
+        } else if (key == "rate") {
+            config.rateLimit = std::atof(value.c_str());
+        } else if (key == "burst") {
+            config.burst = std::atof(value.c_str());
+        } else if (key == "backlog" && std::atoi(value.c_str()) > 0) {
+            config.backlog = std::atoi(value.c_str());
+        } else {
+            error = "unknown or invalid setting '" + field + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string ListenerConfig::describe() const {
+    std::ostringstream out;
+    out << name << " on " << address.toString()
+        << " (" << (framing == SessionProfile::BINARY ? "binary" : "newline") << " mode, ";
+    if (workers > 0) {
+        out << workers << " workers, ";
+    } else {
+        out << "main loop, ";
+    }
+    if (rateLimit > 0) {
+        out << "rate " << rateLimit << "/s, ";
+    }
+    if (burst > 0) {
+        out << "burst " << burst << ", ";
+    }
+    out << "backlog " << backlog << ")";
+    return out.str();
+}
+
+Listener::Listener(boost::asio::io_context& loop, Room& r, const ListenerConfig& c):
+    config(c),
+    room(r),
+    mainLoop(loop) {
+    auto sessionProfile = std::make_shared<SessionProfile>();
+    sessionProfile->listener = config.name;
+    sessionProfile->framing = config.framing;
+    sessionProfile->rateLimit = config.rateLimit;
+    sessionProfile->burst = config.burst;
+    profile = sessionProfile;
+
+    if (config.workers > 0) {
+        workerLoop = std::make_unique<boost::asio::io_context>(static_cast<int>(config.workers));
+        acceptExecutor = boost::asio::make_strand(*workerLoop);
+    } else {
+        acceptExecutor = mainLoop.get_executor();
+    }
+    acceptor = std::make_unique<Acceptor>(acceptExecutor);
+    deferTimer = std::make_unique<boost::asio::steady_timer>(acceptExecutor);
+    ring = IoBackend::ringFor(acceptExecutor);
+}
+
+Listener::~Listener() {
+    stop();
+}
+
+void Listener::open(int handedOverFd) {
+    if (config.address.isUnix) {
+        boost::asio::local::stream_protocol::endpoint endpoint(config.address.path);
+        if (handedOverFd >= 0) {
+            acceptor->assign(boost::asio::generic::stream_protocol(AF_UNIX, 0), handedOverFd);
+            return;
+        }
+        ::unlink(config.address.path.c_str());
+        acceptor->open(boost::asio::generic::stream_protocol(AF_UNIX, 0));
+        acceptor->bind(endpoint);
+    } else {
+        tcp::endpoint endpoint(boost::asio::ip::make_address(config.address.host), config.address.port);
+        boost::asio::generic::stream_protocol protocol(endpoint.protocol().family(), IPPROTO_TCP);
+        if (handedOverFd >= 0) {
+            acceptor->assign(protocol, handedOverFd);
+            return;
+        }
+        acceptor->open(protocol);
+        acceptor->set_option(boost::asio::socket_base::reuse_address(true));
+        acceptor->bind(endpoint);
+    }
+    acceptor->listen(config.backlog);
+}
+
+void Listener::start() {
+    if (workerLoop) {
+        workerGuard = std::make_unique<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>(
+            workerLoop->get_executor());
+        LoadShedder::getInstance().monitor(config.name, *workerLoop);
+        for (unsigned i = 0; i < config.workers; ++i) {
+            workers.emplace_back([this]() {
+                try {
+                    workerLoop->run();
+                } catch (std::exception& e) {
+                    LOG_ERROR("Listener %s worker: %s", config.name.c_str(), e.what());
+                }
+            });
+        }
+    }
+    onAcceptLoop([this]() { accept(); });
+    LOG_INFO("Listening: %s", config.describe().c_str());
+}
+
+void Listener::stop() {
+    if (!workerLoop) {
+        return;
+    }
+    workerGuard.reset();
+    workerLoop->stop();
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    workers.clear();
+    LoadShedder::getInstance().forget(*workerLoop);
+}
+
+void Listener::pause() {
+    onAcceptLoop([this]() {
+        paused = true;
+        // Connections the ring accepts meanwhile still become sessions
+        if (ring) {
+            ring->cancelAndWait(acceptOp);
+        }
+        boost::system::error_code ec;
+        acceptor->cancel(ec);
+        deferTimer->cancel();
+    });
+}
+
+void Listener::resume() {
+    onAcceptLoop([this]() {
+        paused = false;
+        accept();
+    });
+}
+
+void Listener::close() {
+    onAcceptLoop([this]() {
+        paused = true;
+        if (ring) {
+            ring->cancelAndWait(acceptOp);
+        }
+        boost::system::error_code ec;
+        acceptor->close(ec);
+        deferTimer->cancel();
+    });
+}
+
+boost::asio::any_io_executor Listener::sessionExecutor() {
+    if (workerLoop) {
+        return boost::asio::make_strand(*workerLoop);
+    }
+    return mainLoop.get_executor();
+}
+
+void Listener::onAcceptLoop(std::function<void()> f) {
+    if (!workerLoop) {
+        f();
+        return;
+    }
+    // Waits for the workers to run it: a hot restart sends the descriptor
+    // right after pause(), and nothing may be accepted from it after that
+    std::packaged_task<void()> task(std::move(f));
+    auto done = task.get_future();
+    boost::asio::post(acceptExecutor, [&task]() { task(); });
+    done.get();
+}
+
+bool Listener::deferAccept() {
+    if (!LoadShedder::getInstance().acceptsPaused()) {
+        return false;
+    }
+    deferTimer->expires_after(std::chrono::milliseconds(100));
+    deferTimer->async_wait([this](const boost::system::error_code& ec) {
+        // Paused for a hot restart meanwhile: resume() starts accepting again
+        if (!ec && !paused && acceptor->is_open()) {
+            accept();
+        }
+    });
+    return true;
+}
+
+// Turn a new connection away with an error while the server sheds load
+void Listener::refuse(Session::Socket& socket) {
+    static const std::string notice = "Server overloaded, please try again later\n";
+    boost::system::error_code ec;
+    if (config.framing == SessionProfile::BINARY) {
+        boost::asio::write(socket, boost::asio::buffer(Message(notice).getData()), ec);
+    } else {
+        boost::asio::write(socket, boost::asio::buffer(notice), ec);
+    }
+    socket.close(ec);
+    MetricsCollector::getInstance().recordMetric("sessions_refused", 1);
+}
+
+void Listener::accept() {
+    if (paused || deferAccept()) {
+        return;
+    }
+    if (ring) {
+        acceptMultishot();
+        return;
+    }
+
+    acceptor->async_accept(sessionExecutor(), [this](boost::system::error_code ec, Session::Socket socket) {
+        // Acceptor cancelled or closed (e.g. during a hot restart handover)
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (!ec && LoadShedder::getInstance().refusingSessions()) {
+            refuse(socket);
+        } else if (!ec) {
+            std::make_shared<Session>(std::move(socket), room, profile)->start();
+        }
+        accept();
+    });
+}
+
+void Listener::acceptMultishot() {
+    if (acceptOp) {
+        return;
+    }
+    acceptOp = ring->accept(static_cast<int>(acceptor->native_handle()), [this](int result, const char*, bool more) {
+        if (!more) {
+            acceptOp = 0;
+        }
+        if (result >= 0) {
+            boost::system::error_code ec;
+            Session::Socket socket(mainLoop);
+            socket.assign(protocol(), result, ec);
+            if (ec) {
+                ::close(result);
+            } else if (LoadShedder::getInstance().refusingSessions()) {
+                refuse(socket);
+            } else {
+                std::make_shared<Session>(std::move(socket), room, profile)->start();
+            }
+        }
+        
+        // The request ended (cancelled, or an error the kernel does not retry), or
+        // accepting is to pause under overload: accept() decides what comes next
+        if (!more) {
+            accept();
+        } else if (LoadShedder::getInstance().acceptsPaused()) {
+            ring->cancel(acceptOp);
+        }
+    });
+}
+
+boost::asio::generic::stream_protocol Listener::protocol() const {
+    if (config.address.isUnix) {
+        return boost::asio::generic::stream_protocol(AF_UNIX, 0);
+    }
+    bool v6 = boost::asio::ip::make_address(config.address.host).is_v6();
+    return boost::asio::generic::stream_protocol(v6 ? AF_INET6 : AF_INET, IPPROTO_TCP);
+}
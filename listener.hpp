@@ -0,0 +1,102 @@
+#ifndef LISTENER_HPP
+#define LISTENER_HPP
+
+#include "chatroom.hpp"
+#include "cluster.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+// Client-facing listening sockets.
+//
+// A server can listen on several ports or Unix sockets, each configured on
+// its own, e.g. to keep bots apart from people:
+//
+//     --listen 9000
+//     --listen 0.0.0.0:9100,name=bots,workers=2,mode=binary,rate=50,burst=100,backlog=4096
+//     --listen unix:/run/chat.sock
+//
+//     name      used in logs, lag metrics and hot restart roles
+//     workers   threads serving this listener's sessions, up to 256; 0 (the
+//               default) serves them on the main event loop
+//     mode      newline (text lines) or binary (Message frames)
+//     rate      messages per second per client; default is --rate-limit
+//     burst     messages a client may send at once; default is the server's
+//     backlog   listen backlog
+//
+// Every listener feeds the same room. Sessions of a listener with workers
+// each run on their own strand of the listener's event loop; the room and
+// the other shared state they touch are safe to use from several threads.
+struct ListenerConfig {
+    enum {maxWorkers = 256};
+
+    std::string name;
+    ClusterAddress address;
+    unsigned workers = 0;
+    SessionProfile::Framing framing = SessionProfile::NEWLINE;
+    double rateLimit = 0;
+    double burst = 0;
+    int backlog = boost::asio::socket_base::max_listen_connections;
+
+    // "<port>|<host:port>|unix:<path>[,key=value...]"; false with error set if malformed
+    static bool parse(const std::string& spec, ListenerConfig& config, std::string& error);
+    std::string describe() const;
+};
+
+class Listener {
+    public:
+        typedef boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> Acceptor;
+
+        Listener(boost::asio::io_context& mainLoop, Room& room, const ListenerConfig& config);
+        ~Listener();
+
+        // Binds the address, or adopts a listening socket handed over by a hot restart
+        void open(int handedOverFd = -1);
+        // Starts the workers (if any) and accepting
+        void start();
+        // Stops accepting and joins the workers
+        void stop();
+
+        // Hot restart (see HandoverListener)
+        std::string role() const { return "client-" + config.name; }
+        int nativeHandle() { return static_cast<int>(acceptor->native_handle()); }
+        void pause();
+        void resume();
+        void close();
+
+        const ListenerConfig& getConfig() const { return config; }
+        SessionProfilePointer getProfile() const { return profile; }
+        // Where a new session of this listener runs: the main loop, or its own
+        // strand on the listener's workers
+        boost::asio::any_io_executor sessionExecutor();
+
+    private:
+        void accept();
+        // While critically overloaded, stop accepting for a moment so new
+        // connections wait in the listen backlog. False if accepting may go on.
+        bool deferAccept();
+        void refuse(Session::Socket& socket);
+        // Accepting through the ring: one multishot request until cancelled
+        void acceptMultishot();
+        boost::asio::generic::stream_protocol protocol() const;
+        // Runs f where the acceptor's handlers run and returns once it has;
+        // right away on the main loop. Workers must be running.
+        void onAcceptLoop(std::function<void()> f);
+
+        ListenerConfig config;
+        SessionProfilePointer profile;
+        Room& room;
+        boost::asio::io_context& mainLoop;
+        std::unique_ptr<boost::asio::io_context> workerLoop;
+        std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> workerGuard;
+        std::vector<std::thread> workers;
+        boost::asio::any_io_executor acceptExecutor;
+        std::unique_ptr<Acceptor> acceptor;
+        std::unique_ptr<boost::asio::steady_timer> deferTimer;
+        bool paused = false;
+        // Set when the main loop accepts through io_uring (see io_backend.hpp)
+        UringLoop* ring = nullptr;
+        uint64_t acceptOp = 0;
+};
+
+#endif // LISTENER_HPP
@@ -0,0 +1,201 @@
+#ifndef LOAD_SHEDDER_HPP
+#define LOAD_SHEDDER_HPP
+
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "rate_limiter.hpp"
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <boost/asio.hpp>
+
+// Event-loop lag monitoring and adaptive load shedding.
+//
+// Every monitored io_context runs a probe timer that should fire every
+// probeInterval; how late it actually fires is that loop's lag, recorded as
+// event_loop_lag_<worker>. A smoothed lag (so that one slow handler does not
+// count as overload) together with the number of messages queued for
+// output across all sessions it drives a three-step controller:
+//
+//     NORMAL     everything served
+//     DEGRADED   new sessions are refused with an error, rate limits drop,
+//                PINGs and !metrics are shed
+//     CRITICAL   as DEGRADED, accepts pause (connections wait in the backlog)
+//                and rate limits drop further
+//
+// Being over the global memory budget (see memory_accounting.hpp) counts
+// as DEGRADED as well.
+//
+// Overload escalates immediately; the level only steps down after the
+// load has stayed below it for recoveryHold, so the server does not flap.
+class LoadShedder {
+public:
+    enum Level { NORMAL = 0, DEGRADED = 1, CRITICAL = 2 };
+
+    struct Thresholds {
+        std::chrono::microseconds degradedLag{20000};
+        std::chrono::microseconds criticalLag{200000};
+        long degradedQueue = 50000;
+        long criticalQueue = 500000;
+        std::chrono::milliseconds recoveryHold{1000};
+        double degradedRateFactor = 0.5;
+        double criticalRateFactor = 0.2;
+    };
+
+    static LoadShedder& getInstance() {
+        static LoadShedder instance;
+        return instance;
+    }
+
+    void configure(const Thresholds& newThresholds) {
+        std::lock_guard<std::mutex> lock(mtx);
+        thresholds = newThresholds;
+        enabled = true;
+    }
+
+    // Start measuring the lag of the loop running io
+    void monitor(const std::string& worker, boost::asio::io_context& io) {
+        std::lock_guard<std::mutex> lock(mtx);
+        workers.emplace_back();
+        Worker& w = workers.back();
+        w.name = worker;
+        w.metricName = "event_loop_lag_" + worker;
+        w.loop = &io;
+        w.timer = std::make_unique<boost::asio::steady_timer>(io);
+        
+        // Start once the loop runs, or server start-up would count as lag
+        boost::asio::post(io, [this, &w]() { probe(w); });
+    }
+
+    // Stop measuring io. The probe's timer must go before io does, and while
+    // io runs no handlers any more (its threads are joined, or run() returned).
+    void forget(boost::asio::io_context& io) {
+        std::lock_guard<std::mutex> lock(mtx);
+        workers.remove_if([&io](const Worker& w) { return w.loop == &io; });
+    }
+
+    // Stop measuring every loop; for shutdown, before any of them is destroyed
+    void stop() {
+        std::lock_guard<std::mutex> lock(mtx);
+        workers.clear();
+    }
+
+    Level level() const { return currentLevel.load(std::memory_order_relaxed); }
+    bool refusingSessions() const { return level() >= DEGRADED; }
+    bool shedLowPriority() const { return level() >= DEGRADED; }
+    bool acceptsPaused() const { return level() >= CRITICAL; }
+
+    // Messages queued for output across all sessions
+    void addQueued(long delta) { queuedMessages.fetch_add(delta, std::memory_order_relaxed); }
+    long queued() const { return queuedMessages.load(std::memory_order_relaxed); }
+
+    static const char* levelName(Level level) {
+        switch (level) {
+            case NORMAL: return "normal";
+            case DEGRADED: return "degraded";
+            case CRITICAL: return "critical";
+            default: return "unknown";
+        }
+    }
+
+private:
+    LoadShedder() = default;
+    LoadShedder(const LoadShedder&) = delete;
+    LoadShedder& operator=(const LoadShedder&) = delete;
+
+    enum {probeIntervalMs = 10};
+
+    struct Worker {
+        std::string name;
+        std::string metricName;
+        boost::asio::io_context* loop = nullptr;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+        std::atomic<int64_t> lagUs{0};  // smoothed
+    };
+
+    void probe(Worker& w) {
+        w.timer->expires_after(std::chrono::milliseconds(probeIntervalMs));
+        w.timer->async_wait([this, &w](const boost::system::error_code& ec) {
+            if (ec) {
+                return;
+            }
+            auto lag = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - w.timer->expiry()).count();
+            int64_t smoothed = w.lagUs.load(std::memory_order_relaxed);
+            w.lagUs.store(smoothed + (lag - smoothed) / 4, std::memory_order_relaxed);
+            MetricsCollector::getInstance().recordMetric(w.metricName, lag);
+            evaluate();
+            probe(w);
+        });
+    }
+
+    void evaluate() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!enabled) {
+            return;
+        }
+
+        int64_t worstLag = 0;
+        for (const auto& w : workers) {
+            worstLag = std::max(worstLag, w.lagUs.load(std::memory_order_relaxed));
+        }
+        long depth = queued();
+
+        Level wanted = NORMAL;
+        if (worstLag >= thresholds.criticalLag.count() || depth >= thresholds.criticalQueue) {
+            wanted = CRITICAL;
+        } else if (worstLag >= thresholds.degradedLag.count() || depth >= thresholds.degradedQueue ||
+                   MemoryAccounting::getInstance().overGlobalBudget()) {
+            wanted = DEGRADED;
+        }
+
+        Level current = level();
+        auto now = std::chrono::steady_clock::now();
+        if (wanted > current) {
+            setLevel(wanted, worstLag, depth);
+        } else if (wanted < current) {
+            // Step down one level at a time, each after a quiet period
+            if (!recovering) {
+                recovering = true;
+                recoveringSince = now;
+            } else if (now - recoveringSince >= thresholds.recoveryHold) {
+                setLevel(static_cast<Level>(current - 1), worstLag, depth);
+                recoveringSince = now;
+            }
+            return;
+        }
+        recovering = false;
+    }
+
+    void setLevel(Level next, int64_t lagUs, long depth) {
+        Level previous = level();
+        currentLevel.store(next, std::memory_order_relaxed);
+
+        double factor = next == CRITICAL ? thresholds.criticalRateFactor
+                      : next == DEGRADED ? thresholds.degradedRateFactor : 1.0;
+        RateLimiter::getInstance().setLoadFactor(factor);
+
+        if (next > previous) {
+            LOG_WARNING("Load shedding %s -> %s (loop lag %lld us, %ld messages queued)",
+                        levelName(previous), levelName(next), static_cast<long long>(lagUs), depth);
+        } else {
+            LOG_INFO("Load shedding %s -> %s (loop lag %lld us, %ld messages queued)",
+                     levelName(previous), levelName(next), static_cast<long long>(lagUs), depth);
+        }
+        MetricsCollector::getInstance().recordMetric("load_shed_level", next);
+    }
+
+    std::mutex mtx;
+    bool enabled = false;
+    Thresholds thresholds;
+    std::list<Worker> workers;  // stable addresses for the probe handlers
+    std::atomic<Level> currentLevel{NORMAL};
+    std::atomic<long> queuedMessages{0};
+    bool recovering = false;
+    std::chrono::steady_clock::time_point recoveringSince;
+};
+
+#endif // LOAD_SHEDDER_HPP
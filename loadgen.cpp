@@ -0,0 +1,222 @@
+#include "message.hpp"
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <boost/asio.hpp>
+
+// Load generator for chatApp.
+//
+// Usage: loadApp <port> [--host <addr>] [--clients N] [--messages M]
+//                [--size B] [--rate R] [--json]
+//
+// Opens N connections, then has every client send M messages of B bytes,
+// either as fast as the server accepts them or at R messages/second per
+// client. Each message carries its send time, so the receiving clients
+// measure end-to-end delivery latency. Prints throughput and latency
+// percentiles, optionally as JSON for comparing runs.
+
+using boost::asio::ip::tcp;
+
+struct LoadStats {
+    size_t sent = 0;
+    size_t received = 0;
+    size_t rejected = 0;
+    std::vector<double> latenciesUs;
+    std::chrono::steady_clock::time_point lastReceive;
+};
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class LoadClient : public std::enable_shared_from_this<LoadClient> {
+public:
+    LoadClient(boost::asio::io_context& io, int index, LoadStats& stats)
+        : socket(io), timer(io), index(index), stats(stats) {}
+
+    void connect(const tcp::resolver::results_type& endpoints) {
+        boost::asio::connect(socket, endpoints);
+        socket.set_option(tcp::no_delay(true));
+    }
+
+    void start(size_t messages, size_t size, double rate) {
+        remaining = messages;
+        messageSize = size;
+        interval = rate > 0 ? std::chrono::nanoseconds(static_cast<int64_t>(1e9 / rate))
+                            : std::chrono::nanoseconds(0);
+        read();
+        send();
+    }
+
+    bool done() const { return remaining == 0 && !writing; }
+
+private:
+    void send() {
+        if (remaining == 0) return;
+
+        outbound = "LG " + std::to_string(index) + " " + std::to_string(nowNs()) + " ";
+        if (outbound.size() < messageSize) {
+            outbound.append(messageSize - outbound.size(), 'x');
+        }
+        outbound += "\n";
+
+        auto self(shared_from_this());
+        writing = true;
+        boost::asio::async_write(socket, boost::asio::buffer(outbound),
+            [this, self](boost::system::error_code ec, std::size_t) {
+                writing = false;
+                if (ec) {
+                    remaining = 0;
+                    return;
+                }
+                stats.sent++;
+                remaining--;
+                if (interval.count() == 0) {
+                    send();
+                } else {
+                    timer.expires_after(interval);
+                    timer.async_wait([this, self](const boost::system::error_code& ec) {
+                        if (!ec) send();
+                    });
+                }
+            });
+    }
+
+    void read() {
+        auto self(shared_from_this());
+        boost::asio::async_read_until(socket, input, "\n",
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) return;
+                std::string line(boost::asio::buffers_begin(input.data()),
+                                 boost::asio::buffers_begin(input.data()) + length);
+                input.consume(length);
+
+                if (line.rfind("LG ", 0) == 0) {
+                    size_t first = line.find(' ', 3);
+                    uint64_t sentNs = std::strtoull(line.c_str() + first + 1, nullptr, 10);
+                    stats.received++;
+                    stats.latenciesUs.push_back((nowNs() - sentNs) / 1000.0);
+                    stats.lastReceive = std::chrono::steady_clock::now();
+                } else if (line.rfind("Rate limit", 0) == 0) {
+                    stats.rejected++;
+                }
+                read();
+            });
+    }
+
+    tcp::socket socket;
+    boost::asio::steady_timer timer;
+    boost::asio::streambuf input;
+    std::string outbound;
+    int index;
+    LoadStats& stats;
+    size_t remaining = 0;
+    size_t messageSize = 0;
+    bool writing = false;
+    std::chrono::nanoseconds interval{0};
+};
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * p))];
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: loadApp <port> [--host <addr>] [--clients N] [--messages M]\n"
+                  << "               [--size B] [--rate R] [--json]\n";
+        return 1;
+    }
+
+    std::string port = argv[1];
+    std::string host = "127.0.0.1";
+    int clients = 10;
+    size_t messages = 1000;
+    size_t size = 64;
+    double rate = 0;
+    bool json = false;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) host = argv[++i];
+        else if (arg == "--clients" && i + 1 < argc) clients = std::atoi(argv[++i]);
+        else if (arg == "--messages" && i + 1 < argc) messages = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--size" && i + 1 < argc) size = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--rate" && i + 1 < argc) rate = std::atof(argv[++i]);
+        else if (arg == "--json") json = true;
+    }
+    size = std::min(size, static_cast<size_t>(Message::maxBytes));
+
+    boost::asio::io_context io;
+    tcp::resolver resolver(io);
+    auto endpoints = resolver.resolve(host, port);
+
+    LoadStats stats;
+    std::vector<std::shared_ptr<LoadClient>> loadClients;
+    for (int i = 0; i < clients; ++i) {
+        auto client = std::make_shared<LoadClient>(io, i, stats);
+        client->connect(endpoints);
+        loadClients.push_back(client);
+    }
+
+    // Let the server register every session before traffic starts
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto start = std::chrono::steady_clock::now();
+    stats.lastReceive = start;
+    for (auto& client : loadClients) {
+        client->start(messages, size, rate);
+    }
+
+    // Finish once everything is sent and deliveries have stopped arriving
+    size_t expected = messages * clients * (clients - 1);
+    boost::asio::steady_timer checker(io);
+    std::function<void()> check = [&]() {
+        checker.expires_after(std::chrono::milliseconds(50));
+        checker.async_wait([&](const boost::system::error_code&) {
+            bool allSent = std::all_of(loadClients.begin(), loadClients.end(),
+                                       [](const auto& c) { return c->done(); });
+            auto idle = std::chrono::steady_clock::now() - stats.lastReceive;
+            if (allSent && (stats.received >= expected || idle > std::chrono::seconds(2))) {
+                io.stop();
+            } else {
+                check();
+            }
+        });
+    };
+    check();
+    io.run();
+
+    double seconds = std::chrono::duration<double>(stats.lastReceive - start).count();
+    if (seconds <= 0) seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(stats.latenciesUs.begin(), stats.latenciesUs.end());
+
+    if (json) {
+        std::cout << "{\"clients\": " << clients
+                  << ", \"sent\": " << stats.sent
+                  << ", \"received\": " << stats.received
+                  << ", \"expected\": " << expected
+                  << ", \"rejected\": " << stats.rejected
+                  << ", \"seconds\": " << seconds
+                  << ", \"sent_per_sec\": " << stats.sent / seconds
+                  << ", \"delivered_per_sec\": " << stats.received / seconds
+                  << ", \"latency_us_p50\": " << percentile(stats.latenciesUs, 0.50)
+                  << ", \"latency_us_p99\": " << percentile(stats.latenciesUs, 0.99)
+                  << ", \"latency_us_max\": " << (stats.latenciesUs.empty() ? 0 : stats.latenciesUs.back())
+                  << "}" << std::endl;
+    } else {
+        std::cout << "Sent " << stats.sent << " messages, received " << stats.received
+                  << " of " << expected << " deliveries (" << stats.rejected << " rate limited) in "
+                  << seconds << " s\n"
+                  << "  " << stats.sent / seconds << " msgs/s sent, "
+                  << stats.received / seconds << " deliveries/s\n"
+                  << "  latency p50 " << percentile(stats.latenciesUs, 0.50) << " us, p99 "
+                  << percentile(stats.latenciesUs, 0.99) << " us, max "
+                  << (stats.latenciesUs.empty() ? 0 : stats.latenciesUs.back()) << " us" << std::endl;
+    }
+    return 0;
+}
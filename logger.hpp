@@ -1,6 +1,7 @@
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
+#include <atomic>
 #include <string>
 #include <fstream>
 #include <mutex>
@@ -50,13 +51,14 @@ public:
         }
     }
     
+    // May change at runtime (see runtime_config.hpp) while other threads log
     void setLogLevel(LogLevel level) {
-        currentLevel = level;
+        currentLevel.store(level, std::memory_order_relaxed);
     }
     
     template<typename... Args>
     void log(LogLevel level, const std::string& format, Args... args) {
-        if (level < currentLevel) return;
+        if (level < currentLevel.load(std::memory_order_relaxed)) return;
         
         std::lock_guard<std::mutex> lock(logMutex);
         
@@ -118,7 +120,7 @@ private:
     
     std::ofstream logFile;
     std::mutex logMutex;
-    LogLevel currentLevel;
+    std::atomic<LogLevel> currentLevel;
 };
 
 // Define logging macros after the class definition
@@ -0,0 +1,122 @@
+#ifndef MEMORY_ACCOUNTING_HPP
+#define MEMORY_ACCOUNTING_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+// Byte accounting for the parts of chatApp that grow with load.
+//
+// Each subsystem reports allocations and releases as deltas; the figures are
+// estimates of heap use (payload plus container capacity or a fixed
+// per-entry overhead), not allocator-exact. Budgets are enforced where the
+// memory is spent:
+//
+//     sessionInputBytes   cap on a session's input buffer; a client sending a
+//                         longer line is disconnected
+//     sessionOutputBytes  cap on a session's queued output; a consumer that
+//                         falls this far behind is disconnected
+//     globalBytes         above this the load shedder degrades (0 = no limit)
+//     metricSamples       samples kept per metric; older ones are overwritten
+class MemoryAccounting {
+public:
+    enum Subsystem {
+        SESSION_INPUT,
+        SESSION_OUTPUT,
+        RATE_LIMITER,
+        METRICS,
+        METRIC_TIMERS,
+        SESSION_ACCOUNTING,
+        SUBSYSTEM_COUNT
+    };
+
+    struct Budgets {
+        size_t sessionInputBytes = 64 * 1024;
+        size_t sessionOutputBytes = 4 * 1024 * 1024;
+        size_t globalBytes = 0;
+        size_t metricSamples = 100000;
+    };
+
+    // Rough heap cost of one hash map entry beyond its key and value
+    enum {mapEntryOverhead = 64};
+
+    static MemoryAccounting& getInstance() {
+        static MemoryAccounting instance;
+        return instance;
+    }
+
+    void setBudgets(const Budgets& newBudgets) { budgets = newBudgets; }
+    const Budgets& getBudgets() const { return budgets; }
+
+    void add(Subsystem subsystem, long delta) {
+        counters[subsystem].bytes.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    long bytes(Subsystem subsystem) const {
+        return counters[subsystem].bytes.load(std::memory_order_relaxed);
+    }
+
+    long total() const {
+        long sum = 0;
+        for (int i = 0; i < SUBSYSTEM_COUNT; ++i) {
+            sum += bytes(static_cast<Subsystem>(i));
+        }
+        return sum;
+    }
+
+    bool overGlobalBudget() const {
+        return budgets.globalBytes > 0 && total() > static_cast<long>(budgets.globalBytes);
+    }
+
+    // Sessions currently accounted, for per-session averages
+    void addSessions(long delta) { sessions.fetch_add(delta, std::memory_order_relaxed); }
+
+    std::string generateReport() const {
+        long sessionCount = sessions.load(std::memory_order_relaxed);
+        long sessionBytes = bytes(SESSION_INPUT) + bytes(SESSION_OUTPUT);
+
+        std::stringstream ss;
+        ss << "=== Memory ===\n";
+        for (int i = 0; i < SUBSYSTEM_COUNT; ++i) {
+            ss << "  " << name(static_cast<Subsystem>(i)) << ": "
+               << bytes(static_cast<Subsystem>(i)) << " bytes\n";
+        }
+        ss << "  total: " << total() << " bytes";
+        if (budgets.globalBytes > 0) {
+            ss << " of " << budgets.globalBytes << " budget";
+        }
+        ss << "\n  sessions: " << sessionCount << ", "
+           << (sessionCount > 0 ? sessionBytes / sessionCount : 0) << " bytes per session\n";
+        return ss.str();
+    }
+
+    static const char* name(Subsystem subsystem) {
+        switch (subsystem) {
+            case SESSION_INPUT: return "session_input";
+            case SESSION_OUTPUT: return "session_output";
+            case RATE_LIMITER: return "rate_limiter";
+            case METRICS: return "metrics";
+            case METRIC_TIMERS: return "metric_timers";
+            case SESSION_ACCOUNTING: return "session_accounting";
+            default: return "unknown";
+        }
+    }
+
+private:
+    MemoryAccounting() = default;
+    MemoryAccounting(const MemoryAccounting&) = delete;
+    MemoryAccounting& operator=(const MemoryAccounting&) = delete;
+
+    // Counters are updated from every worker; keep each on its own cache line
+    struct alignas(64) Counter {
+        std::atomic<long> bytes{0};
+    };
+
+    std::array<Counter, SUBSYSTEM_COUNT> counters;
+    std::atomic<long> sessions{0};
+    Budgets budgets;
+};
+
+#endif // MEMORY_ACCOUNTING_HPP
@@ -55,7 +55,7 @@ class Message {
         
        bool decodeHeader(){
             char new_header[header+1] = "";
-            strncpy(new_header, data, header);
+            memcpy(new_header, data, header);
             new_header[header] = '\0';
             int headerValue = atoi(new_header);
             if(headerValue > maxBytes){
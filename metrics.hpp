@@ -11,6 +11,10 @@
 #include <thread>
 #include <atomic>
 #include <functional>
+#include <condition_variable>
+#include <sstream>
+#include "memory_accounting.hpp"
+#include "session_accounting.hpp"
 
 class MetricsCollector {
 public:
@@ -22,7 +26,13 @@ public:
     // Start a timer for an operation
     void startTimer(const std::string& operation, const std::string& id) {
         std::lock_guard<std::mutex> lock(mtx);
-        timers[operation + "_" + id] = std::chrono::high_resolution_clock::now();
+        std::string key = operation + "_" + id;
+        auto result = timers.emplace(key, std::chrono::high_resolution_clock::now());
+        if (result.second) {
+            MemoryAccounting::getInstance().add(MemoryAccounting::METRIC_TIMERS, timerEntryBytes(key));
+        } else {
+            result.first->second = std::chrono::high_resolution_clock::now();
+        }
     }
     
     // End a timer and record the duration
@@ -36,14 +46,23 @@ public:
         auto start = it->second;
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
         
-        metrics[operation].push_back(duration);
-        timers.erase(it);
+        addSample(operation, duration);
+        eraseTimer(it);
+    }
+    
+    // Drop a timer whose operation failed or was abandoned, recording nothing
+    void cancelTimer(const std::string& operation, const std::string& id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = timers.find(operation + "_" + id);
+        if (it != timers.end()) {
+            eraseTimer(it);
+        }
     }
     
     // Record a metric directly
     void recordMetric(const std::string& name, double value) {
         std::lock_guard<std::mutex> lock(mtx);
-        metrics[name].push_back(value);
+        addSample(name, value);
     }
     
     // Get summary statistics for a metric
@@ -59,32 +78,11 @@ public:
     MetricStats getStats(const std::string& name) {
         std::lock_guard<std::mutex> lock(mtx);
         
-        if (metrics.find(name) == metrics.end() || metrics[name].empty()) {
+        auto it = metrics.find(name);
+        if (it == metrics.end() || it->second.values.empty()) {
             return MetricStats{0, 0, 0, 0, 0, 0};
         }
-        
-        auto& values = metrics[name];
-        size_t count = values.size();
-        
-        // Calculate basic statistics
-        double sum = std::accumulate(values.begin(), values.end(), 0.0);
-        double avg = sum / count;
-        
-        // Sort for percentiles
-        std::vector<double> sorted = values;
-        std::sort(sorted.begin(), sorted.end());
-        
-        double min = sorted.front();
-        double max = sorted.back();
-        
-        // Calculate percentiles
-        size_t p95_idx = static_cast<size_t>(count * 0.95);
-        size_t p99_idx = static_cast<size_t>(count * 0.99);
-        
-        double p95 = sorted[p95_idx];
-        double p99 = sorted[p99_idx];
-        
-        return MetricStats{min, max, avg, p95, p99, count};
+        return computeStats(it->second.values);
     }
     
     // Start periodic reporting
@@ -95,59 +93,146 @@ public:
         reporterRunning = true;
         reporterThread = std::thread([this, intervalSeconds, reportCallback]() {
             while (reporterRunning) {
-                std::this_thread::sleep_for(std::chrono::seconds(intervalSeconds));
+                // Wait for the interval, waking early if reporting is stopped
+                {
+                    std::unique_lock<std::mutex> lock(reporterMutex);
+                    reporterWakeup.wait_for(lock, std::chrono::seconds(intervalSeconds),
+                                            [this]() { return !reporterRunning; });
+                }
+                if (!reporterRunning) break;
                 
                 std::string report = generateReport();
                 reportCallback(report);
+                SessionAccounting::getInstance().startWindow();
             }
         });
     }
     
     void stopReporting() {
-        reporterRunning = false;
+        {
+            std::lock_guard<std::mutex> lock(reporterMutex);
+            reporterRunning = false;
+        }
+        reporterWakeup.notify_all();
         if (reporterThread.joinable()) {
             reporterThread.join();
         }
     }
     
     std::string generateReport() {
-        std::lock_guard<std::mutex> lock(mtx);
-        
         std::stringstream ss;
         ss << "=== Performance Metrics Report ===\n";
         
+        std::unique_lock<std::mutex> lock(mtx);
         for (const auto& entry : metrics) {
-            if (entry.second.empty()) continue;
+            if (entry.second.values.empty()) continue;
             
-            auto stats = getStats(entry.first);
+            // mtx is already held, so compute directly rather than via getStats();
+            // once a metric has more samples than the budget, the latest ones are summarized
+            auto stats = computeStats(entry.second.values);
             
-            ss << entry.first << " (count: " << stats.count << "):\n"
+            ss << entry.first << " (count: " << entry.second.recorded << "):\n"
                << "  Min: " << stats.min << " μs\n"
                << "  Avg: " << stats.avg << " μs\n"
                << "  Max: " << stats.max << " μs\n"
                << "  P95: " << stats.p95 << " μs\n"
                << "  P99: " << stats.p99 << " μs\n";
         }
+        lock.unlock();
         
+        // Sampling every session takes a while; recording goes on meanwhile
+        ss << MemoryAccounting::getInstance().generateReport();
+        ss << SessionAccounting::getInstance().generateReport();
         return ss.str();
     }
     
     void clearMetrics() {
         std::lock_guard<std::mutex> lock(mtx);
+        for (const auto& entry : metrics) {
+            MemoryAccounting::getInstance().add(MemoryAccounting::METRICS, -seriesBytes(entry.first, entry.second));
+        }
         metrics.clear();
     }
     
 private:
     MetricsCollector() : reporterRunning(false) {}
+    
+    // Samples of one metric; beyond the sample budget the oldest are overwritten
+    struct Series {
+        std::vector<double> values;
+        uint64_t recorded = 0;
+    };
+    
+    void addSample(const std::string& name, double value) {
+        auto& accounting = MemoryAccounting::getInstance();
+        auto result = metrics.try_emplace(name);
+        Series& series = result.first->second;
+        long before = result.second ? 0 : seriesBytes(name, series);
+        
+        size_t limit = std::max<size_t>(1, accounting.getBudgets().metricSamples);
+        if (series.values.size() < limit) {
+            series.values.push_back(value);
+        } else {
+            series.values[series.recorded % limit] = value;
+        }
+        series.recorded++;
+        
+        long after = seriesBytes(name, series);
+        if (after != before) {
+            accounting.add(MemoryAccounting::METRICS, after - before);
+        }
+    }
+    
+    static long seriesBytes(const std::string& name, const Series& series) {
+        return MemoryAccounting::mapEntryOverhead + name.size() + sizeof(Series) +
+               series.values.capacity() * sizeof(double);
+    }
+    
+    static long timerEntryBytes(const std::string& key) {
+        return MemoryAccounting::mapEntryOverhead + key.size() +
+               sizeof(std::chrono::high_resolution_clock::time_point);
+    }
+    
+    template<typename Iterator>
+    void eraseTimer(Iterator it) {
+        MemoryAccounting::getInstance().add(MemoryAccounting::METRIC_TIMERS, -timerEntryBytes(it->first));
+        timers.erase(it);
+    }
+    
+    static MetricStats computeStats(const std::vector<double>& values) {
+        size_t count = values.size();
+        
+        // Calculate basic statistics
+        double sum = std::accumulate(values.begin(), values.end(), 0.0);
+        double avg = sum / count;
+        
+        // Sort for percentiles
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        
+        double min = sorted.front();
+        double max = sorted.back();
+        
+        // Calculate percentiles
+        size_t p95_idx = static_cast<size_t>(count * 0.95);
+        size_t p99_idx = static_cast<size_t>(count * 0.99);
+        
+        double p95 = sorted[p95_idx];
+        double p99 = sorted[p99_idx];
+        
+        return MetricStats{min, max, avg, p95, p99, count};
+    }
     ~MetricsCollector() {
         stopReporting();
     }
     
     std::unordered_map<std::string, std::chrono::time_point<std::chrono::high_resolution_clock>> timers;
-    std::unordered_map<std::string, std::vector<double>> metrics;
+    std::unordered_map<std::string, Series> metrics;
     std::mutex mtx;
     
     std::thread reporterThread;
+    std::mutex reporterMutex;
+    std::condition_variable reporterWakeup;
     std::atomic<bool> reporterRunning;
 };
 
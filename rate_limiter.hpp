@@ -5,6 +5,7 @@
 #include <string>
 #include <chrono>
 #include <mutex>
+#include "memory_accounting.hpp"
 
 class RateLimiter {
 public:
@@ -13,27 +14,29 @@ public:
         return instance;
     }
     
-    // Check if client can send a message
-    bool checkLimit(const std::string& clientId) {
+    // Check if client can send a message. rate and burst are the client's
+    // own limits (its listener's profile); 0 uses the server-wide ones.
+    bool checkLimit(const std::string& clientId, double rate = 0, double burst = 0) {
         std::lock_guard<std::mutex> lock(mtx);
         
         auto now = std::chrono::steady_clock::now();
-        auto& client = clients[clientId];
+        auto& client = findOrAdd(clientId);
+        double capacity = burst > 0 ? burst : maxTokens;
         
         // First message from this client
         if (client.lastRequest.time_since_epoch().count() == 0) {
             client.lastRequest = now;
             client.messageCount = 1;
-            client.tokensAvailable = maxTokens - 1;
+            client.tokensAvailable = capacity - 1;
             return true;
         }
         
         // Calculate time passed and tokens to add
         std::chrono::duration<double> elapsed = now - client.lastRequest;
-        double tokensToAdd = elapsed.count() * tokenRefillRate;
+        double tokensToAdd = elapsed.count() * (rate > 0 ? rate : tokenRefillRate) * loadFactor;
         
         // Update tokens
-        client.tokensAvailable = std::min(maxTokens, client.tokensAvailable + tokensToAdd);
+        client.tokensAvailable = std::min(capacity, client.tokensAvailable + tokensToAdd);
         
         // Check if we have a token available
         if (client.tokensAvailable < 1.0) {
@@ -50,11 +53,19 @@ public:
         return true;
     }
     
-    void setRateLimit(double messagesPerSecond) {
-        maxTokens = 5.0;  // Allow burst of 5 messages
+    // Server-wide limits; burst is how many messages a client may send at once
+    void setRateLimit(double messagesPerSecond, double burst = 5.0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        maxTokens = burst;
         tokenRefillRate = messagesPerSecond;
     }
     
+    // Scales every client's refill rate; lowered while the server sheds load
+    void setLoadFactor(double factor) {
+        std::lock_guard<std::mutex> lock(mtx);
+        loadFactor = factor;
+    }
+    
     // Get stats for a client
     struct ClientStats {
         int messageCount = 0;
@@ -71,6 +82,50 @@ public:
         return ClientStats{client.messageCount, client.rateLimitExceeded};
     }
     
+    // Token bucket of one client, used to carry limits across a hot restart
+    struct ClientState {
+        double tokensAvailable = 0.0;
+        double secondsSinceLastRequest = 0.0;
+        int messageCount = 0;
+        int rateLimitExceeded = 0;
+    };
+    
+    bool exportClient(const std::string& clientId, ClientState& state) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = clients.find(clientId);
+        if (it == clients.end()) {
+            return false;
+        }
+        
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - it->second.lastRequest;
+        state.tokensAvailable = it->second.tokensAvailable;
+        state.secondsSinceLastRequest = elapsed.count();
+        state.messageCount = it->second.messageCount;
+        state.rateLimitExceeded = it->second.rateLimitExceeded;
+        return true;
+    }
+    
+    void importClient(const std::string& clientId, const ClientState& state) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& client = findOrAdd(clientId);
+        client.tokensAvailable = state.tokensAvailable;
+        client.lastRequest = std::chrono::steady_clock::now() -
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(state.secondsSinceLastRequest));
+        client.messageCount = state.messageCount;
+        client.rateLimitExceeded = state.rateLimitExceeded;
+    }
+    
+    // Forget a client whose session has ended
+    void removeClient(const std::string& clientId) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = clients.find(clientId);
+        if (it != clients.end()) {
+            MemoryAccounting::getInstance().add(MemoryAccounting::RATE_LIMITER, -entryBytes(it->first));
+            clients.erase(it);
+        }
+    }
+    
 private:
     RateLimiter() : maxTokens(5.0), tokenRefillRate(1.0) {}
     
@@ -81,10 +136,23 @@ private:
         double tokensAvailable = 0.0;
     };
     
+    ClientInfo& findOrAdd(const std::string& clientId) {
+        auto result = clients.try_emplace(clientId);
+        if (result.second) {
+            MemoryAccounting::getInstance().add(MemoryAccounting::RATE_LIMITER, entryBytes(clientId));
+        }
+        return result.first->second;
+    }
+    
+    static long entryBytes(const std::string& clientId) {
+        return MemoryAccounting::mapEntryOverhead + clientId.size() + sizeof(ClientInfo);
+    }
+    
     std::unordered_map<std::string, ClientInfo> clients;
     std::mutex mtx;
     double maxTokens;
     double tokenRefillRate;
+    double loadFactor = 1.0;
 };
 
 #endif // RATE_LIMITER_HPP
\ No newline at end of file
@@ -0,0 +1,337 @@
+#include "message.hpp"
+#include "traffic_trace.hpp"
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+// Replays a traffic trace recorded with chatApp --capture against a server.
+//
+// Usage: replayApp <port> <trace> [--host <addr>] [--speed X] [--binary] [--json]
+//
+// Every connection of the trace is opened, fed messages of the recorded sizes
+// and closed at the recorded moment, or X times faster. Contents are made up:
+// each message carries its send time, so every replayed client measures the
+// delivery latency of what it receives. Prints throughput, the latency
+// distribution and how far the replay fell behind the trace's schedule,
+// optionally as JSON for comparing runs. --binary speaks Message frames, for
+// a listener with mode=binary.
+
+using boost::asio::ip::tcp;
+
+struct ReplayStats {
+    size_t sent = 0;
+    size_t received = 0;
+    size_t rejected = 0;
+    size_t failedConnects = 0;
+    std::vector<double> latenciesUs;
+    std::vector<double> scheduleLagUs;
+    std::chrono::steady_clock::time_point lastActivity;
+};
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class ReplayClient : public std::enable_shared_from_this<ReplayClient> {
+public:
+    ReplayClient(boost::asio::io_context& io, uint64_t connection, bool binary, ReplayStats& stats)
+        : socket(io), connection(connection), binary(binary), stats(stats) {}
+
+    void connect(const tcp::resolver::results_type& endpoints) {
+        auto self(shared_from_this());
+        boost::asio::async_connect(socket, endpoints,
+            [this, self](boost::system::error_code ec, const tcp::endpoint&) {
+                if (ec) {
+                    stats.failedConnects++;
+                    outbound.clear();
+                    return;
+                }
+                connected = true;
+                boost::system::error_code ignored;
+                socket.set_option(tcp::no_delay(true), ignored);
+                read();
+                write();
+            });
+    }
+
+    // A message of the recorded size on the wire, newline or frame header included
+    void send(size_t bytes) {
+        std::string body = "RP " + std::to_string(connection) + " " + std::to_string(nowNs()) + " ";
+        if (binary) {
+            size_t length = std::min<size_t>(bytes > Message::header ? bytes - Message::header : 0,
+                                             Message::maxBytes);
+            if (body.size() < length) {
+                body.append(length - body.size(), 'x');
+            }
+            outbound.push_back(Message(body).getData());
+        } else {
+            if (body.size() + 1 < bytes) {
+                body.append(bytes - body.size() - 1, 'x');
+            }
+            outbound.push_back(body + "\n");
+        }
+        if (connected && outbound.size() == 1) {
+            write();
+        }
+    }
+
+    // Closes once everything queued so far has been written
+    void disconnect() {
+        closing = true;
+        if (outbound.empty()) {
+            close();
+        }
+    }
+
+    bool idle() const { return outbound.empty(); }
+
+private:
+    void write() {
+        if (outbound.empty()) {
+            if (closing) {
+                close();
+            }
+            return;
+        }
+        auto self(shared_from_this());
+        boost::asio::async_write(socket, boost::asio::buffer(outbound.front()),
+            [this, self](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    outbound.clear();
+                    return;
+                }
+                stats.sent++;
+                outbound.pop_front();
+                write();
+            });
+    }
+
+    void read() {
+        auto self(shared_from_this());
+        if (binary) {
+            boost::asio::async_read(socket, input, boost::asio::transfer_exactly(Message::header),
+                [this, self](boost::system::error_code ec, std::size_t) {
+                    if (ec) return;
+                    std::string header(boost::asio::buffers_begin(input.data()),
+                                       boost::asio::buffers_begin(input.data()) + Message::header);
+                    size_t length = std::strtoul(header.c_str(), nullptr, 10);
+                    input.consume(Message::header);
+                    boost::asio::async_read(socket, input, boost::asio::transfer_exactly(length),
+                        [this, self, length](boost::system::error_code ec, std::size_t) {
+                            if (ec) return;
+                            std::string line(boost::asio::buffers_begin(input.data()),
+                                             boost::asio::buffers_begin(input.data()) + length);
+                            input.consume(length);
+                            received(line);
+                            read();
+                        });
+                });
+            return;
+        }
+        boost::asio::async_read_until(socket, input, "\n",
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) return;
+                std::string line(boost::asio::buffers_begin(input.data()),
+                                 boost::asio::buffers_begin(input.data()) + length);
+                input.consume(length);
+                received(line);
+                read();
+            });
+    }
+
+    void received(const std::string& line) {
+        if (line.rfind("RP ", 0) == 0) {
+            size_t first = line.find(' ', 3);
+            uint64_t sentNs = std::strtoull(line.c_str() + first + 1, nullptr, 10);
+            stats.received++;
+            stats.latenciesUs.push_back((nowNs() - sentNs) / 1000.0);
+            stats.lastActivity = std::chrono::steady_clock::now();
+        } else if (line.rfind("Rate limit", 0) == 0) {
+            stats.rejected++;
+        }
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        socket.shutdown(tcp::socket::shutdown_both, ec);
+        socket.close(ec);
+    }
+
+    tcp::socket socket;
+    boost::asio::streambuf input;
+    std::deque<std::string> outbound;
+    uint64_t connection;
+    bool binary;
+    bool connected = false;
+    bool closing = false;
+    ReplayStats& stats;
+};
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * p))];
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: replayApp <port> <trace> [--host <addr>] [--speed X] [--binary] [--json]\n";
+        return 1;
+    }
+
+    std::string port = argv[1];
+    std::string tracePath = argv[2];
+    std::string host = "127.0.0.1";
+    double speed = 1;
+    bool binary = false;
+    bool json = false;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) host = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc) speed = std::atof(argv[++i]);
+        else if (arg == "--binary") binary = true;
+        else if (arg == "--json") json = true;
+    }
+    if (speed <= 0) {
+        std::cerr << "--speed must be positive\n";
+        return 1;
+    }
+
+    TraceReader reader;
+    if (!reader.open(tracePath)) {
+        std::cerr << "Cannot read trace " << tracePath << "\n";
+        return 1;
+    }
+    std::vector<TraceEvent> events;
+    TraceEvent event;
+    while (reader.next(event)) {
+        events.push_back(event);
+    }
+    if (events.empty()) {
+        std::cerr << "Trace " << tracePath << " has no events\n";
+        return 1;
+    }
+
+    boost::asio::io_context io;
+    tcp::resolver resolver(io);
+    auto endpoints = resolver.resolve(host, port);
+
+    ReplayStats stats;
+    std::unordered_map<uint64_t, std::shared_ptr<ReplayClient>> clients;
+    size_t connections = 0;
+    size_t next = 0;
+
+    // Every event is played at its trace time divided by the speed; the
+    // delay between that moment and the actual send is the schedule lag
+    auto start = std::chrono::steady_clock::now();
+    auto due = [&](const TraceEvent& e) {
+        return start + std::chrono::nanoseconds(static_cast<int64_t>(e.timeUs * 1000.0 / speed));
+    };
+    auto play = [&](const TraceEvent& e) {
+        if (e.type == TraceEvent::CONNECT) {
+            auto client = std::make_shared<ReplayClient>(io, e.connection, binary, stats);
+            client->connect(endpoints);
+            clients[e.connection] = client;
+            connections++;
+            return;
+        }
+        auto it = clients.find(e.connection);
+        if (it == clients.end()) {
+            return;   // connected before the capture started
+        }
+        if (e.type == TraceEvent::MESSAGE) {
+            it->second->send(e.bytes);
+        } else {
+            it->second->disconnect();
+            clients.erase(it);
+        }
+    };
+
+    boost::asio::steady_timer scheduler(io);
+    std::function<void()> schedule = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        while (next < events.size() && due(events[next]) <= now) {
+            stats.scheduleLagUs.push_back(
+                std::chrono::duration<double, std::micro>(now - due(events[next])).count());
+            play(events[next++]);
+        }
+        stats.lastActivity = now;
+        if (next < events.size()) {
+            scheduler.expires_at(due(events[next]));
+            scheduler.async_wait([&](const boost::system::error_code& ec) {
+                if (!ec) schedule();
+            });
+        }
+    };
+    schedule();
+
+    // Finish once the trace is played, everything is written and deliveries
+    // have stopped arriving
+    boost::asio::steady_timer checker(io);
+    std::function<void()> check = [&]() {
+        checker.expires_after(std::chrono::milliseconds(50));
+        checker.async_wait([&](const boost::system::error_code&) {
+            bool allSent = next == events.size() &&
+                std::all_of(clients.begin(), clients.end(), [](const auto& c) { return c.second->idle(); });
+            auto quiet = std::chrono::steady_clock::now() - stats.lastActivity;
+            if (allSent && quiet > std::chrono::seconds(1)) {
+                io.stop();
+            } else {
+                check();
+            }
+        });
+    };
+    check();
+    io.run();
+
+    double traceSeconds = events.back().timeUs / 1e6;
+    double seconds = std::chrono::duration<double>(stats.lastActivity - start).count();
+    if (seconds <= 0) seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(stats.latenciesUs.begin(), stats.latenciesUs.end());
+    std::sort(stats.scheduleLagUs.begin(), stats.scheduleLagUs.end());
+    auto max = [](const std::vector<double>& sorted) { return sorted.empty() ? 0 : sorted.back(); };
+
+    if (json) {
+        std::cout << "{\"events\": " << events.size()
+                  << ", \"connections\": " << connections
+                  << ", \"failed_connects\": " << stats.failedConnects
+                  << ", \"speed\": " << speed
+                  << ", \"trace_seconds\": " << traceSeconds
+                  << ", \"seconds\": " << seconds
+                  << ", \"sent\": " << stats.sent
+                  << ", \"received\": " << stats.received
+                  << ", \"rejected\": " << stats.rejected
+                  << ", \"sent_per_sec\": " << stats.sent / seconds
+                  << ", \"delivered_per_sec\": " << stats.received / seconds
+                  << ", \"latency_us_p50\": " << percentile(stats.latenciesUs, 0.50)
+                  << ", \"latency_us_p90\": " << percentile(stats.latenciesUs, 0.90)
+                  << ", \"latency_us_p99\": " << percentile(stats.latenciesUs, 0.99)
+                  << ", \"latency_us_p999\": " << percentile(stats.latenciesUs, 0.999)
+                  << ", \"latency_us_max\": " << max(stats.latenciesUs)
+                  << ", \"schedule_lag_us_p99\": " << percentile(stats.scheduleLagUs, 0.99)
+                  << ", \"schedule_lag_us_max\": " << max(stats.scheduleLagUs)
+                  << "}" << std::endl;
+    } else {
+        std::cout << "Replayed " << events.size() << " events over " << connections << " connections ("
+                  << stats.failedConnects << " failed) at " << speed << "x: "
+                  << traceSeconds << " s of trace in " << seconds << " s\n"
+                  << "  sent " << stats.sent << " messages, received " << stats.received
+                  << " deliveries (" << stats.rejected << " rate limited)\n"
+                  << "  " << stats.sent / seconds << " msgs/s sent, "
+                  << stats.received / seconds << " deliveries/s\n"
+                  << "  latency p50 " << percentile(stats.latenciesUs, 0.50) << " us, p90 "
+                  << percentile(stats.latenciesUs, 0.90) << " us, p99 "
+                  << percentile(stats.latenciesUs, 0.99) << " us, p99.9 "
+                  << percentile(stats.latenciesUs, 0.999) << " us, max "
+                  << max(stats.latenciesUs) << " us\n"
+                  << "  schedule lag p99 " << percentile(stats.scheduleLagUs, 0.99) << " us, max "
+                  << max(stats.scheduleLagUs) << " us" << std::endl;
+    }
+    return 0;
+}
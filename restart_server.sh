@@ -1,18 +1,30 @@
 #!/bin/bash
-# Script to restart the server with fresh logs
+# Script to restart the server
+#
+# If a server is running with its control socket, the new process takes over
+# its listening socket and live client connections (hot restart) and the old
+# one exits by itself. Otherwise the server is restarted with fresh logs.
+#
+# Usage: ./restart_server.sh <port> [extra chatApp options]
 
 # Make sure the script is executable
 chmod +x "$0"
 
-# Kill any running server instances
-pkill -f chatApp || true
+CONTROL=${CONTROL:-chat_server.ctl}
 
-# Wait for processes to terminate
-sleep 1
+if pgrep -f chatApp > /dev/null && [ -S "$CONTROL" ]; then
+    ./chatApp "$@" --control "$CONTROL" --takeover "$CONTROL" &
+    echo "Hot restart requested. Log entries:"
+else
+    # Kill any running server instances
+    pkill -f chatApp || true
 
-# Start server with specified port
-./chatApp $1 &
+    # Wait for processes to terminate
+    sleep 1
 
-# Show initial log entries
-echo "Server started. Initial log entries:"
-tail -f chat_server.log
\ No newline at end of file
+    # Start server with specified port
+    ./chatApp "$@" --control "$CONTROL" &
+    echo "Server started. Initial log entries:"
+fi
+
+tail -f chat_server.log
@@ -0,0 +1,221 @@
+#include "runtime_config.hpp"
+#include "rate_limiter.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+const char* const keys[] = {
+    "rate_limit", "burst", "heartbeat", "history", "max_message_bytes", "log_level"
+};
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+        case DEBUG: return "debug";
+        case INFO: return "info";
+        case WARNING: return "warning";
+        case ERROR: return "error";
+        default: return "unknown";
+    }
+}
+
+std::string valueOf(const Settings& settings, const std::string& key) {
+    std::ostringstream out;
+    if (key == "rate_limit") out << settings.rateLimit;
+    else if (key == "burst") out << settings.burst;
+    else if (key == "heartbeat") out << settings.heartbeat.count();
+    else if (key == "history") out << settings.historySize;
+    else if (key == "max_message_bytes") out << settings.maxMessageBytes;
+    else if (key == "log_level") out << levelName(settings.logLevel);
+    return out.str();
+}
+
+std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+// Whole string as a number, or false
+bool toNumber(const std::string& value, double& number) {
+    char* end = nullptr;
+    number = std::strtod(value.c_str(), &end);
+    return !value.empty() && *end == '\0';
+}
+
+} // namespace
+
+RuntimeConfig::RuntimeConfig() {
+    active = std::make_shared<const Settings>();
+}
+
+SettingsPointer RuntimeConfig::snapshot() const {
+    std::lock_guard<std::mutex> lock(activeMutex);
+    return active;
+}
+
+bool RuntimeConfig::assign(Settings& settings, const std::string& key, const std::string& value, std::string& error) {
+    double number = 0;
+    bool numeric = toNumber(value, number);
+
+    if (key == "rate_limit" && numeric && number > 0) {
+        settings.rateLimit = number;
+    } else if (key == "burst" && numeric && number >= 1) {
+        settings.burst = number;
+    } else if (key == "heartbeat" && numeric && number >= 0) {
+        settings.heartbeat = std::chrono::seconds(static_cast<long>(number));
+    } else if (key == "history" && numeric && number >= 0) {
+        settings.historySize = static_cast<size_t>(number);
+    } else if (key == "max_message_bytes" && numeric && number >= 1 && number <= static_cast<double>(Message::maxBytes)) {
+        settings.maxMessageBytes = static_cast<size_t>(number);
+    } else if (key == "log_level" && (value == "debug" || value == "info" || value == "warning" || value == "error")) {
+        settings.logLevel = value == "debug" ? DEBUG : value == "info" ? INFO : value == "warning" ? WARNING : ERROR;
+    } else if (std::find(std::begin(keys), std::end(keys), key) == std::end(keys)) {
+        error = "unknown setting '" + key + "'";
+        return false;
+    } else {
+        error = "invalid value '" + value + "' for " + key;
+        return false;
+    }
+    return true;
+}
+
+bool RuntimeConfig::parseFile(const std::string& configPath, Settings& settings, std::string& error) {
+    std::ifstream file(configPath);
+    if (!file) {
+        error = "cannot read " + configPath;
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        size_t equals = line.find('=');
+        std::string settingError;
+        if (equals == std::string::npos) {
+            settingError = "expected 'key = value'";
+        } else {
+            assign(settings, trim(line.substr(0, equals)), trim(line.substr(equals + 1)), settingError);
+        }
+        // One bad line rejects the whole file rather than applying half of it
+        if (!settingError.empty()) {
+            error = configPath + ":" + std::to_string(lineNumber) + ": " + settingError;
+            return false;
+        }
+    }
+    return true;
+}
+
+void RuntimeConfig::publish(Settings next) {
+    SettingsPointer current = snapshot();
+    const Settings& previous = *current;
+
+    RateLimiter::getInstance().setRateLimit(next.rateLimit, next.burst);
+    Logger::getInstance().setLogLevel(next.logLevel);
+
+    if (previous.version > 0) {
+        for (const char* key : keys) {
+            std::string before = valueOf(previous, key);
+            std::string after = valueOf(next, key);
+            if (before != after) {
+                LOG_INFO("Configuration: %s changed from %s to %s", key, before.c_str(), after.c_str());
+            }
+        }
+    }
+
+    next.version = previous.version + 1;
+    SettingsPointer replacement = std::make_shared<const Settings>(std::move(next));
+    {
+        std::lock_guard<std::mutex> lock(activeMutex);
+        active = replacement;
+    }
+    version.store(replacement->version, std::memory_order_release);
+}
+
+void RuntimeConfig::initialize(const Settings& startupSettings) {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    startup = startupSettings;
+    publish(startup);
+}
+
+bool RuntimeConfig::load(const std::string& configPath) {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    Settings next = startup;
+    std::string error;
+    if (!parseFile(configPath, next, error)) {
+        LOG_ERROR("Configuration: %s, keeping the current settings", error.c_str());
+        return false;
+    }
+    path = configPath;
+    publish(std::move(next));
+    LOG_INFO("Configuration loaded from %s", configPath.c_str());
+    return true;
+}
+
+bool RuntimeConfig::reload() {
+    std::string configPath;
+    {
+        std::lock_guard<std::mutex> lock(updateMutex);
+        configPath = path;
+    }
+    return !configPath.empty() && load(configPath);
+}
+
+bool RuntimeConfig::set(const std::string& key, const std::string& value, std::string& error) {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    Settings next = *snapshot();
+    if (!assign(next, key, value, error)) {
+        return false;
+    }
+    publish(std::move(next));
+    return true;
+}
+
+std::string RuntimeConfig::describe() const {
+    SettingsPointer settings = snapshot();
+    std::string out;
+    for (const char* key : keys) {
+        out += std::string(key) + " = " + valueOf(*settings, key) + "\n";
+    }
+    return out;
+}
+
+std::string RuntimeConfig::handleCommand(const std::string& line) {
+    std::istringstream words(line);
+    std::string command;
+    words >> command;
+
+    if (command == "CONFIG") {
+        return describe() + "OK\n";
+    }
+    if (command == "SET") {
+        std::string key;
+        words >> key;
+        std::string value;
+        std::getline(words, value);
+        value = trim(value);
+        std::string error;
+        if (!set(key, value, error)) {
+            return "ERROR " + error + "\n";
+        }
+        return "OK " + key + " = " + valueOf(*snapshot(), key) + "\n";
+    }
+    if (command == "RELOAD") {
+        {
+            std::lock_guard<std::mutex> lock(updateMutex);
+            if (path.empty()) {
+                return "ERROR no config file (start with --config <file>)\n";
+            }
+        }
+        return reload() ? "OK\n" : "ERROR reload failed, see the log\n";
+    }
+    return "ERROR unknown command '" + command + "' (CONFIG, SET <key> <value>, RELOAD)\n";
+}
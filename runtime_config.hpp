@@ -0,0 +1,103 @@
+#ifndef RUNTIME_CONFIG_HPP
+#define RUNTIME_CONFIG_HPP
+
+#include "logger.hpp"
+#include "message.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Settings that can change while the server runs.
+//
+// They start out from the defaults and the command line, then a config file
+// (--config <file>) of "key = value" lines overrides them:
+//
+//     rate_limit            messages per second per client
+//     burst                 messages a client may send at once
+//     heartbeat             seconds between PINGs; 0 turns them off
+//     history               room messages kept for newcomers and handovers
+//     max_message_bytes     longer messages are cut; at most Message::maxBytes
+//     log_level             debug, info, warning or error
+//
+// SIGHUP re-reads the file (settings removed from it go back to their
+// startup values). The control socket (--control <path>, see
+// hot_restart.hpp) also takes admin commands, one per line:
+//
+//     CONFIG                the current settings
+//     SET <key> <value>     changes one setting until the next reload
+//     RELOAD                re-reads the file
+//
+// Every change publishes a new immutable Settings snapshot and then bumps
+// an atomic version number. Each thread keeps the snapshot it last fetched;
+// on the delivery path a read is one load of the version, and only the
+// first read after a change takes a lock to fetch the new snapshot. A
+// replaced snapshot is freed once every thread has moved on from it.
+
+struct Settings {
+    double rateLimit = 5.0;
+    double burst = 5.0;
+    std::chrono::seconds heartbeat{30};
+    size_t historySize = 100;
+    size_t maxMessageBytes = Message::maxBytes;
+    LogLevel logLevel = INFO;
+    uint64_t version = 0;   // bumped by every change
+};
+
+typedef std::shared_ptr<const Settings> SettingsPointer;
+
+class RuntimeConfig {
+public:
+    static RuntimeConfig& getInstance() {
+        static RuntimeConfig instance;
+        return instance;
+    }
+
+    // The settings in effect, as this thread last fetched them. The
+    // reference is valid until the thread's next call after a change, so
+    // read what is needed right away rather than keeping it.
+    static const Settings& current() {
+        thread_local SettingsPointer seen;
+        RuntimeConfig& config = getInstance();
+        if (!seen || seen->version != config.version.load(std::memory_order_acquire)) {
+            seen = config.snapshot();
+        }
+        return *seen;
+    }
+
+    // The settings in effect, for readers that keep them for a while
+    SettingsPointer snapshot() const;
+
+    // Startup values (defaults and command line) that the file applies on top of
+    void initialize(const Settings& startup);
+    // Reads the file and publishes the result; on failure nothing changes
+    bool load(const std::string& configPath);
+    bool reload();
+    // One setting by its file key; false with error set if key or value is invalid
+    bool set(const std::string& key, const std::string& value, std::string& error);
+
+    // "key = value" lines
+    std::string describe() const;
+    // An admin command from the control socket; returns the reply
+    std::string handleCommand(const std::string& line);
+
+private:
+    RuntimeConfig();
+    RuntimeConfig(const RuntimeConfig&) = delete;
+    RuntimeConfig& operator=(const RuntimeConfig&) = delete;
+
+    static bool assign(Settings& settings, const std::string& key, const std::string& value, std::string& error);
+    static bool parseFile(const std::string& path, Settings& settings, std::string& error);
+    // Applies what other components hold themselves and swaps the snapshot in; called with updateMutex held
+    void publish(Settings next);
+
+    mutable std::mutex updateMutex;   // one change at a time
+    Settings startup;
+    std::string path;
+    mutable std::mutex activeMutex;   // held only to swap or copy the pointer
+    SettingsPointer active;
+    std::atomic<uint64_t> version{0};  // that of active, stored once it is in place
+};
+
+#endif // RUNTIME_CONFIG_HPP
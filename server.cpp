@@ -0,0 +1,367 @@
+#include "chatroom.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "cluster.hpp"
+#include "shm_ring.hpp"
+#include "hot_restart.hpp"
+#include "io_backend.hpp"
+#include "load_shedder.hpp"
+#include "content_filter.hpp"
+#include "traffic_trace.hpp"
+#include "runtime_config.hpp"
+#include "listener.hpp"
+
+using boost::asio::ip::address_v4;
+
+int main(int argc, char *argv[]) {
+    try {
+        // Print metrics and exit, before anything is bound
+        for (int i = 1; i < argc; ++i) {
+            if (std::string(argv[i]) == "--metrics") {
+                std::cout << MetricsCollector::getInstance().generateReport() << std::endl;
+                return 0;
+            }
+        }
+        
+        // Client listeners, from bare ports, --listen and --unix
+        std::vector<ListenerConfig> listenerConfigs;
+        auto addListener = [&](const std::string& spec) {
+            ListenerConfig config;
+            std::string error;
+            if (!ListenerConfig::parse(spec, config, error)) {
+                std::cerr << "Invalid listener '" << spec << "': " << error << "\n";
+                return false;
+            }
+            auto named = [&](const std::string& name) {
+                return std::any_of(listenerConfigs.begin(), listenerConfigs.end(),
+                                   [&](const ListenerConfig& other) { return other.name == name; });
+            };
+            // The first TCP and Unix listeners keep the hot restart roles of single-listener servers
+            if (config.name.empty()) {
+                config.name = config.address.isUnix ? "unix" : "tcp";
+                if (named(config.name)) {
+                    config.name += "-" + (config.address.isUnix ? std::to_string(listenerConfigs.size())
+                                                                : std::to_string(config.address.port));
+                }
+            }
+            if (named(config.name)) {
+                std::cerr << "Duplicate listener name '" << config.name << "'\n";
+                return false;
+            }
+            listenerConfigs.push_back(config);
+            return true;
+        };
+        
+        int firstOption = 1;
+        for (; firstOption < argc && argv[firstOption][0] != '-'; ++firstOption) {
+            if (!addListener(argv[firstOption])) {
+                return 1;
+            }
+        }
+        
+        // Cluster options
+        std::string clusterId;
+        std::string clusterListen;
+        std::vector<std::string> clusterPeers;
+        
+        // Shared memory transports
+        std::vector<std::string> shmNames;
+        uint64_t shmSize = 1 << 20;
+        
+        // Hot restart
+        std::string controlPath;
+        std::string takeoverPath;
+        
+        double rateLimit = 5.0;
+        // Runtime-tunable settings (see runtime_config.hpp)
+        std::string configPath;
+        
+        // Broadcast micro-batching, off unless a window is given
+        long batchWindowUs = 0;
+        size_t batchMax = 64;
+        
+        // Load shedding starts at this loop lag or output backlog; critical at ten times either
+        long shedLagMs = 20;
+        long shedQueue = 50000;
+        
+        MemoryAccounting::Budgets memoryBudgets;
+        
+        // Content filter rules, reloaded on SIGHUP
+        std::string filterPath;
+        // Ingress timeline for replayApp
+        std::string capturePath;
+        IoBackend::Mode ioBackendMode = IoBackend::AUTO;
+        for (int i = firstOption; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--listen" && i + 1 < argc) {
+                if (!addListener(argv[++i])) {
+                    return 1;
+                }
+            } else if (arg == "--cluster-id" && i + 1 < argc) {
+                clusterId = argv[++i];
+            } else if (arg == "--cluster-listen" && i + 1 < argc) {
+                clusterListen = argv[++i];
+            } else if (arg == "--cluster-peer" && i + 1 < argc) {
+                clusterPeers.push_back(argv[++i]);
+            } else if (arg == "--unix" && i + 1 < argc) {
+                if (!addListener(std::string("unix:") + argv[++i])) {
+                    return 1;
+                }
+            } else if (arg == "--shm" && i + 1 < argc) {
+                shmNames.push_back(argv[++i]);
+            } else if (arg == "--shm-size" && i + 1 < argc) {
+                shmSize = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--control" && i + 1 < argc) {
+                controlPath = argv[++i];
+            } else if (arg == "--takeover" && i + 1 < argc) {
+                takeoverPath = argv[++i];
+            } else if (arg == "--rate-limit" && i + 1 < argc) {
+                rateLimit = std::atof(argv[++i]);
+            } else if (arg == "--batch-window" && i + 1 < argc) {
+                batchWindowUs = std::atol(argv[++i]);
+            } else if (arg == "--batch-max" && i + 1 < argc) {
+                batchMax = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--shed-lag" && i + 1 < argc) {
+                shedLagMs = std::atol(argv[++i]);
+            } else if (arg == "--shed-queue" && i + 1 < argc) {
+                shedQueue = std::atol(argv[++i]);
+            } else if (arg == "--filter" && i + 1 < argc) {
+                filterPath = argv[++i];
+            } else if (arg == "--config" && i + 1 < argc) {
+                configPath = argv[++i];
+            } else if (arg == "--capture" && i + 1 < argc) {
+                capturePath = argv[++i];
+            } else if (arg == "--io-backend" && i + 1 < argc) {
+                if (!IoBackend::parseMode(argv[++i], ioBackendMode)) {
+                    std::cerr << "Invalid --io-backend '" << argv[i] << "': expected auto, epoll or io_uring\n";
+                    return 1;
+                }
+            } else if (arg == "--reject-controls") {
+                Session::setControlPolicy(IngestScanner::REJECT_CONTROLS);
+            } else if (arg == "--memory-budget" && i + 1 < argc) {
+                memoryBudgets.globalBytes = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--session-input-budget" && i + 1 < argc) {
+                memoryBudgets.sessionInputBytes = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--session-output-budget" && i + 1 < argc) {
+                memoryBudgets.sessionOutputBytes = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--metric-samples" && i + 1 < argc) {
+                memoryBudgets.metricSamples = std::strtoull(argv[++i], nullptr, 10);
+            }
+        }
+        
+        if (listenerConfigs.empty()) {
+            std::cerr << "Usage: server <port> [<port> ...]\n"
+                      << "       [--listen <[host:]port|unix:path>[,name=<name>][,workers=<n>]\n"
+                      << "                 [,mode=newline|binary][,rate=<messages/sec>][,burst=<n>]\n"
+                      << "                 [,backlog=<n>]] ...\n"
+                      << "       [--cluster-id <id>] [--cluster-listen <host:port|unix:path>]\n"
+                      << "       [--cluster-peer <host:port|unix:path>] ...\n"
+                      << "       [--unix <path>] [--shm <name>] ... [--shm-size <bytes>]\n"
+                      << "       [--control <path>] [--takeover <path>]\n"
+                      << "       [--rate-limit <messages/sec>]\n"
+                      << "       [--batch-window <us>] [--batch-max <messages>]\n"
+                      << "       [--shed-lag <ms>] [--shed-queue <messages>]\n"
+                      << "       [--memory-budget <bytes>] [--session-input-budget <bytes>]\n"
+                      << "       [--session-output-budget <bytes>] [--metric-samples <n>]\n"
+                      << "       [--reject-controls] [--filter <rules file>]\n"
+                      << "       [--config <file>] [--capture <trace file>]\n"
+                      << "       [--io-backend auto|epoll|io_uring]\n";
+            return 1;
+        }
+        
+        MemoryAccounting::getInstance().setBudgets(memoryBudgets);
+        
+        // Initialize logging with file truncation; a process taking over keeps its predecessor's log
+        Logger::getInstance().setLogFile("chat_server.log", takeoverPath.empty()); // true = truncate existing log
+        LOG_INFO("Server starting up...");
+        
+        // Take listeners and sessions over from a running server
+        HandoverState handover;
+        bool tookOver = !takeoverPath.empty() && HotRestart::takeover(takeoverPath, handover);
+        if (!takeoverPath.empty() && !tookOver) {
+            LOG_WARNING("No server to take over at %s, starting fresh", takeoverPath.c_str());
+        }
+        
+        // Settings from the command line, then the config file on top; this
+        // also sets up the rate limit and the log level
+        Settings startupSettings;
+        startupSettings.rateLimit = rateLimit;
+        RuntimeConfig::getInstance().initialize(startupSettings);
+        if (!configPath.empty() && !RuntimeConfig::getInstance().load(configPath)) {
+            return 1;
+        }
+        
+        if (!filterPath.empty() && !ContentFilter::getInstance().load(filterPath)) {
+            return 1;
+        }
+        
+        if (!capturePath.empty() && !TrafficCapture::getInstance().start(capturePath)) {
+            return 1;
+        }
+        
+        // Start metrics reporting
+        MetricsCollector::getInstance().startReporting(60, [](const std::string& report) {
+            LOG_INFO("Performance Report:\n%s", report.c_str());
+        });
+        
+        Room room;
+        boost::asio::io_context io_context;
+        // Before anything creates sockets on the main loop; goes away before the loop does
+        IoBackend ioBackend(io_context, ioBackendMode);
+        HotRestart hotRestart(io_context, room);
+        
+        LoadShedder::Thresholds shedding;
+        shedding.degradedLag = std::chrono::milliseconds(shedLagMs);
+        shedding.criticalLag = std::chrono::milliseconds(shedLagMs * 10);
+        shedding.degradedQueue = shedQueue;
+        shedding.criticalQueue = shedQueue * 10;
+        if (shedLagMs > 0) {  // --shed-lag 0 only measures lag and never sheds
+            LoadShedder::getInstance().configure(shedding);
+        }
+        LoadShedder::getInstance().monitor("main", io_context);
+        // The lag probes' timers must not outlive io_context, however main() is left;
+        // the listeners drop their workers' probes themselves
+        struct StopShedding {
+            ~StopShedding() { LoadShedder::getInstance().stop(); }
+        } stopShedding;
+        // Admin work that takes a while (reloads, control commands) runs here,
+        // one job at a time and off the event loop. Joined on the way out,
+        // before hotRestart and io_context, which its jobs use, go away.
+        boost::asio::thread_pool adminThread(1);
+        // SIGHUP re-reads the config file and recompiles the filter rules on the
+        // admin thread; messages keep flowing with the old settings and
+        // automaton until the new ones are swapped in
+        boost::asio::signal_set reloadSignals(io_context, SIGHUP);
+        std::function<void()> waitForReload = [&]() {
+            reloadSignals.async_wait([&](const boost::system::error_code& ec, int) {
+                if (ec) {
+                    return;
+                }
+                boost::asio::post(adminThread, []() {
+                    RuntimeConfig::getInstance().reload();
+                    ContentFilter::getInstance().reload();
+                });
+                waitForReload();
+            });
+        };
+        if (!filterPath.empty() || !configPath.empty()) {
+            waitForReload();
+        }
+        hotRestart.setCommandHandler([](const std::string& line) {
+            return RuntimeConfig::getInstance().handleCommand(line);
+        }, adminThread.get_executor());
+        // While capturing, SIGINT and SIGTERM shut down cleanly so the trace is complete
+        boost::asio::signal_set stopSignals(io_context);
+        if (!capturePath.empty()) {
+            stopSignals.add(SIGINT);
+            stopSignals.add(SIGTERM);
+            stopSignals.async_wait([&](const boost::system::error_code& ec, int) {
+                if (!ec) {
+                    TrafficCapture::getInstance().stop();
+                    io_context.stop();
+                }
+            });
+        }
+        
+        if (batchWindowUs > 0) {
+            room.setBatching(io_context.get_executor(), std::chrono::microseconds(batchWindowUs), batchMax);
+        }
+        
+        // Bind every listener (or adopt the socket a previous process hands over); accepting starts last
+        std::vector<std::unique_ptr<Listener>> listeners;
+        for (const auto& config : listenerConfigs) {
+            auto listener = std::make_unique<Listener>(io_context, room, config);
+            listener->open(handover.takeListener(listener->role()));
+            Listener& l = *listener;
+            hotRestart.addListener(HandoverListener{
+                l.role(),
+                [&l]() { return l.nativeHandle(); },
+                [&l]() { l.pause(); },
+                [&l]() { l.resume(); },
+                [&l]() { l.close(); }
+            });
+            listeners.push_back(std::move(listener));
+        }
+        
+        LOG_INFO("Server started with %zu listeners (%s backend, %s ingest)", listeners.size(), ioBackend.name(),
+                 IngestScanner::kernelName(IngestScanner::bestKernel()));
+        
+        // Sessions, shared memory channels and history handed over by the previous process
+        std::set<std::string> handedOverShm(handover.shmChannels.begin(), handover.shmChannels.end());
+        if (tookOver) {
+            hotRestart.restore(handover, [&](const std::string& name) -> Listener* {
+                for (const auto& listener : listeners) {
+                    if (listener->getConfig().name == name) {
+                        return listener.get();
+                    }
+                }
+                return nullptr;
+            });
+        }
+        
+        // Shared memory channels, one producer each
+        for (const auto& name : shmNames) {
+            if (handedOverShm.count(name)) {
+                continue;
+            }
+            auto channel = ShmChannel::create(name, shmSize);
+            if (!channel) {
+                LOG_ERROR("Failed to create shared memory channel %s (size must be a power of two, at least 64)", name.c_str());
+                return 1;
+            }
+            std::make_shared<ShmSession>(io_context, std::move(channel), room)->start();
+        }
+        
+        // Federate the room with other chatApp processes
+        std::unique_ptr<ClusterNode> cluster;
+        if (!clusterListen.empty() || !clusterPeers.empty()) {
+            if (clusterId.empty()) {
+                clusterId = "node-" + std::to_string(::getpid());
+            }
+            cluster = std::make_unique<ClusterNode>(io_context, clusterId);
+            cluster->attach(room);
+            
+            ClusterAddress address;
+            if (!clusterListen.empty()) {
+                if (!ClusterAddress::parse(clusterListen, address)) {
+                    LOG_ERROR("Invalid cluster listen address: %s", clusterListen.c_str());
+                    return 1;
+                }
+                cluster->listen(address, handover.takeListener("cluster"));
+                hotRestart.addListener(HandoverListener{
+                    "cluster",
+                    [&]() { return cluster->listenerHandle(); },
+                    [&]() { cluster->pauseListener(); },
+                    [&]() { cluster->resumeListener(); },
+                    [&]() { cluster->closeListener(); }
+                });
+            }
+            for (const auto& peer : clusterPeers) {
+                if (!ClusterAddress::parse(peer, address)) {
+                    LOG_ERROR("Invalid cluster peer address: %s", peer.c_str());
+                    return 1;
+                }
+                cluster->addPeer(address);
+            }
+        }
+        
+        // Listening sockets the previous process had that this one was not configured for
+        for (const auto& listener : handover.listeners) {
+            LOG_WARNING("Closing handed-over %s listener that is not configured", listener.role.c_str());
+            ::close(listener.fd);
+        }
+        
+        for (const auto& listener : listeners) {
+            listener->start();
+        }
+        if (!controlPath.empty()) {
+            hotRestart.listen(controlPath);
+        }
+        io_context.run();
+    }
+    catch (std::exception& e) {
+        LOG_ERROR("Exception: %s", e.what());
+    }
+    
+    return 0;
+}
\ No newline at end of file
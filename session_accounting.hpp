@@ -0,0 +1,320 @@
+#ifndef SESSION_ACCOUNTING_HPP
+#define SESSION_ACCOUNTING_HPP
+
+#include "memory_accounting.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What each session costs, and which clients cost the most.
+//
+// Every session counts the bytes and messages it reads and writes, how long
+// its output waits queued and how long handling its input takes. The
+// counters of a session fill one cache line, taken from the arena of the
+// worker thread it started on. Only the session's own handlers write them,
+// with plain relaxed loads and stores (no locked instructions), so counting
+// costs a few additions and no cache line is shared between sessions.
+//
+// Each report samples every arena. What a session spent since the previous
+// sample (or up to its end, for sessions that closed meanwhile) goes into a
+// space-saving summary per counter. A summary keeps summaryCapacity clients
+// however many connect: anyone with more than 1/summaryCapacity of a
+// counter's total is guaranteed to be in it, and a count is over by at most
+// the error listed with it. The periodic report starts a new window, so the
+// top talkers cover the time since the previous one.
+
+struct alignas(64) SessionCounters {
+    enum Counter { BYTES_IN, BYTES_OUT, MESSAGES_IN, MESSAGES_OUT, QUEUE_NS, PROCESSING_NS, COUNTER_COUNT };
+
+    // Single writer: the session's own thread
+    void add(Counter counter, uint64_t amount) {
+        values[counter].store(values[counter].load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    uint64_t get(Counter counter) const {
+        return values[counter].load(std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, COUNTER_COUNT> values{};
+};
+
+static_assert(sizeof(SessionCounters) == 64, "session counters should fill exactly one cache line");
+
+// Heaviest keys of a weighted stream in bounded memory (Metwally et al.)
+class SpaceSaving {
+public:
+    struct Entry {
+        std::string key;
+        uint64_t count;
+        uint64_t error;   // count may be over by at most this much
+    };
+
+    explicit SpaceSaving(size_t capacity) : capacity(capacity) {}
+
+    void add(const std::string& key, uint64_t weight) {
+        total += weight;
+        auto it = index.find(key);
+        if (it != index.end()) {
+            entries[it->second].count += weight;
+            return;
+        }
+        if (entries.size() < capacity) {
+            index.emplace(key, entries.size());
+            entries.push_back(Entry{key, weight, 0});
+            return;
+        }
+
+        // Full: the smallest entry makes room, and its count becomes the newcomer's error
+        size_t smallest = 0;
+        for (size_t i = 1; i < entries.size(); ++i) {
+            if (entries[i].count < entries[smallest].count) {
+                smallest = i;
+            }
+        }
+        Entry& evicted = entries[smallest];
+        index.erase(evicted.key);
+        index.emplace(key, smallest);
+        evicted.error = evicted.count;
+        evicted.count += weight;
+        evicted.key = key;
+    }
+
+    std::vector<Entry> top(size_t k) const {
+        std::vector<Entry> sorted = entries;
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const Entry& a, const Entry& b) { return a.count > b.count; });
+        sorted.resize(std::min(k, sorted.size()));
+        return sorted;
+    }
+
+    uint64_t getTotal() const { return total; }
+
+    void clear() {
+        entries.clear();
+        index.clear();
+        total = 0;
+    }
+
+private:
+    size_t capacity;
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, size_t> index;
+    uint64_t total = 0;
+};
+
+class SessionAccounting {
+public:
+    enum {shardCount = 16};
+    enum {summaryCapacity = 64};
+    enum {reportedTalkers = 5};
+
+    // A session's counters and where they live
+    struct Slot {
+        SessionCounters* counters = nullptr;
+        uint32_t shard = 0;
+        uint32_t index = 0;
+    };
+
+    static SessionAccounting& getInstance() {
+        static SessionAccounting instance;
+        return instance;
+    }
+
+    // Counters for a new session, from the calling worker's arena
+    Slot acquire(const std::string& label) {
+        static std::atomic<uint32_t> nextShard{0};
+        static thread_local uint32_t workerShard = nextShard.fetch_add(1, std::memory_order_relaxed) % shardCount;
+
+        Shard& shard = shards[workerShard];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        Slot slot;
+        slot.shard = workerShard;
+        if (!shard.freeSlots.empty()) {
+            slot.index = shard.freeSlots.back();
+            shard.freeSlots.pop_back();
+        } else {
+            slot.index = static_cast<uint32_t>(shard.counters.size());
+            shard.counters.emplace_back();
+            shard.info.emplace_back();
+            MemoryAccounting::getInstance().add(MemoryAccounting::SESSION_ACCOUNTING, slotBytes);
+        }
+        slot.counters = &shard.counters[slot.index];
+        shard.info[slot.index] = SlotInfo{label, {}, true};
+        return slot;
+    }
+
+    // The session ended: what it spent since the last sample is counted, and the slot reused
+    void release(const Slot& slot) {
+        if (!slot.counters) {
+            return;
+        }
+        Delta delta;
+        {
+            Shard& shard = shards[slot.shard];
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            delta = takeDelta(shard, slot.index);
+            for (auto& value : slot.counters->values) {
+                value.store(0, std::memory_order_relaxed);
+            }
+            shard.info[slot.index] = SlotInfo{};
+            shard.freeSlots.push_back(slot.index);
+        }
+        std::lock_guard<std::mutex> lock(summaryMutex);
+        fold(delta);
+    }
+
+    // Name shown in the report, e.g. once a client picks a nickname
+    void relabel(const Slot& slot, const std::string& label) {
+        Shard& shard = shards[slot.shard];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        shard.info[slot.index].label = label;
+    }
+
+    std::string generateReport() {
+        sample();
+
+        std::lock_guard<std::mutex> lock(summaryMutex);
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - windowStart).count();
+        std::stringstream ss;
+        ss << "=== Top talkers (last " << seconds << " s) ===\n";
+        for (int c = 0; c < SessionCounters::COUNTER_COUNT; ++c) {
+            const SpaceSaving& summary = summaries[c];
+            if (summary.getTotal() == 0) {
+                continue;
+            }
+            bool time = c == SessionCounters::QUEUE_NS || c == SessionCounters::PROCESSING_NS;
+            ss << "  " << name(static_cast<SessionCounters::Counter>(c)) << " (total "
+               << format(summary.getTotal(), time) << "):\n";
+            for (const auto& entry : summary.top(reportedTalkers)) {
+                ss << "    " << entry.key << ": " << format(entry.count, time)
+                   << " (" << entry.count * 100 / summary.getTotal() << "%";
+                if (entry.error > 0) {
+                    ss << ", at most " << format(entry.error, time) << " over";
+                }
+                ss << ")\n";
+            }
+        }
+        return ss.str();
+    }
+
+    // Starts a new top-talkers window
+    void startWindow() {
+        sample();
+        std::lock_guard<std::mutex> lock(summaryMutex);
+        for (auto& summary : summaries) {
+            summary.clear();
+        }
+        windowStart = std::chrono::steady_clock::now();
+    }
+
+    static const char* name(SessionCounters::Counter counter) {
+        switch (counter) {
+            case SessionCounters::BYTES_IN: return "bytes_in";
+            case SessionCounters::BYTES_OUT: return "bytes_out";
+            case SessionCounters::MESSAGES_IN: return "messages_in";
+            case SessionCounters::MESSAGES_OUT: return "messages_out";
+            case SessionCounters::QUEUE_NS: return "queue_time";
+            case SessionCounters::PROCESSING_NS: return "processing_time";
+            default: return "unknown";
+        }
+    }
+
+private:
+    SessionAccounting() {
+        for (int c = 0; c < SessionCounters::COUNTER_COUNT; ++c) {
+            summaries.emplace_back(summaryCapacity);
+        }
+    }
+    SessionAccounting(const SessionAccounting&) = delete;
+    SessionAccounting& operator=(const SessionAccounting&) = delete;
+
+    // Sampler-side state of a slot, kept off the counters' cache line
+    struct SlotInfo {
+        std::string label;
+        std::array<uint64_t, SessionCounters::COUNTER_COUNT> sampled{};
+        bool live = false;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::deque<SessionCounters> counters;   // stable addresses as the arena grows
+        std::vector<SlotInfo> info;
+        std::vector<uint32_t> freeSlots;
+    };
+
+    struct Delta {
+        std::string label;
+        std::array<uint64_t, SessionCounters::COUNTER_COUNT> spent{};
+    };
+
+    static constexpr long slotBytes = sizeof(SessionCounters) + sizeof(SlotInfo);
+
+    // Called with the shard's mutex held
+    static Delta takeDelta(Shard& shard, uint32_t index) {
+        SlotInfo& info = shard.info[index];
+        Delta delta;
+        delta.label = info.label;
+        for (int c = 0; c < SessionCounters::COUNTER_COUNT; ++c) {
+            uint64_t now = shard.counters[index].get(static_cast<SessionCounters::Counter>(c));
+            delta.spent[c] = now - info.sampled[c];
+            info.sampled[c] = now;
+        }
+        return delta;
+    }
+
+    // Called with summaryMutex held
+    void fold(const Delta& delta) {
+        for (int c = 0; c < SessionCounters::COUNTER_COUNT; ++c) {
+            if (delta.spent[c] > 0) {
+                summaries[c].add(delta.label, delta.spent[c]);
+            }
+        }
+    }
+
+    // One shard at a time, so sessions starting and ending elsewhere are not held up
+    void sample() {
+        std::vector<Delta> deltas;
+        for (auto& shard : shards) {
+            deltas.clear();
+            {
+                std::lock_guard<std::mutex> lock(shard.mtx);
+                for (uint32_t i = 0; i < shard.info.size(); ++i) {
+                    if (shard.info[i].live) {
+                        deltas.push_back(takeDelta(shard, i));
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(summaryMutex);
+            for (const auto& delta : deltas) {
+                fold(delta);
+            }
+        }
+    }
+
+    static std::string format(uint64_t value, bool nanoseconds) {
+        std::ostringstream out;
+        if (nanoseconds) {
+            out << std::fixed << std::setprecision(1) << value / 1e6 << " ms";
+        } else {
+            out << value;
+        }
+        return out.str();
+    }
+
+    std::array<Shard, shardCount> shards;
+    std::mutex summaryMutex;
+    std::vector<SpaceSaving> summaries;
+    std::chrono::steady_clock::time_point windowStart = std::chrono::steady_clock::now();
+};
+
+#endif // SESSION_ACCOUNTING_HPP
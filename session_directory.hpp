@@ -0,0 +1,134 @@
+#ifndef SESSION_DIRECTORY_HPP
+#define SESSION_DIRECTORY_HPP
+
+#include "chatroom.hpp"
+#include <array>
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Index from clientId and nickname to live participants, for direct messages
+// and targeted server notices without scanning a room.
+//
+// Keys are spread over independently locked shards so lookups and
+// registrations from different worker threads rarely meet on the same lock;
+// lookups take the shard lock shared. Entries hold weak pointers and record
+// their owner, so a participant removes exactly its own entries when it is
+// destroyed.
+class SessionDirectory {
+public:
+    static SessionDirectory& getInstance() {
+        static SessionDirectory instance;
+        return instance;
+    }
+
+    void add(const std::string& clientId, const std::shared_ptr<Participant>& participant) {
+        ids.insert(clientId, participant);
+    }
+
+    void remove(const std::string& clientId, const Participant* owner) {
+        ids.erase(clientId, owner);
+    }
+
+    ParticipantPointer find(const std::string& clientId) {
+        return ids.find(clientId);
+    }
+
+    // Claims a nickname; fails if another live participant holds it
+    bool claimNick(const std::string& nick, const std::shared_ptr<Participant>& participant) {
+        return nicks.insertIfFree(nick, participant);
+    }
+
+    void releaseNick(const std::string& nick, const Participant* owner) {
+        nicks.erase(nick, owner);
+    }
+
+    // Resolves a clientId first, then a nickname
+    ParticipantPointer resolve(const std::string& target) {
+        if (auto participant = ids.find(target)) {
+            return participant;
+        }
+        return nicks.find(target);
+    }
+
+    size_t size() {
+        return ids.size();
+    }
+
+private:
+    SessionDirectory() = default;
+    SessionDirectory(const SessionDirectory&) = delete;
+    SessionDirectory& operator=(const SessionDirectory&) = delete;
+
+    struct Entry {
+        std::weak_ptr<Participant> participant;
+        const Participant* owner;
+    };
+
+    class ShardedIndex {
+    public:
+        void insert(const std::string& key, const std::shared_ptr<Participant>& participant) {
+            Shard& shard = shardFor(key);
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            shard.entries[key] = Entry{participant, participant.get()};
+        }
+
+        bool insertIfFree(const std::string& key, const std::shared_ptr<Participant>& participant) {
+            Shard& shard = shardFor(key);
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end() && it->second.owner != participant.get() &&
+                !it->second.participant.expired()) {
+                return false;
+            }
+            shard.entries[key] = Entry{participant, participant.get()};
+            return true;
+        }
+
+        void erase(const std::string& key, const Participant* owner) {
+            Shard& shard = shardFor(key);
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end() && it->second.owner == owner) {
+                shard.entries.erase(it);
+            }
+        }
+
+        ParticipantPointer find(const std::string& key) {
+            Shard& shard = shardFor(key);
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            auto it = shard.entries.find(key);
+            return it == shard.entries.end() ? nullptr : it->second.participant.lock();
+        }
+
+        size_t size() {
+            size_t total = 0;
+            for (auto& shard : shards) {
+                std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                total += shard.entries.size();
+            }
+            return total;
+        }
+
+    private:
+        enum {shardCount = 64};
+
+        // One cache line per shard lock so neighbouring shards do not false-share
+        struct alignas(64) Shard {
+            std::shared_mutex mtx;
+            std::unordered_map<std::string, Entry> entries;
+        };
+
+        Shard& shardFor(const std::string& key) {
+            return shards[std::hash<std::string>{}(key) % shardCount];
+        }
+
+        std::array<Shard, shardCount> shards;
+    };
+
+    ShardedIndex ids;
+    ShardedIndex nicks;
+};
+
+#endif // SESSION_DIRECTORY_HPP
@@ -0,0 +1,288 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Single-producer/single-consumer ring of variable length records.
+//
+// Records are stored as u32 length + payload, padded to 8 bytes. A record
+// never wraps around the end of the data area: if it does not fit, the
+// producer writes a wrap marker and continues at offset 0. Head and tail are
+// free-running byte counters on separate cache lines; each side caches the
+// other side's counter and only reloads it when the ring looks full/empty.
+// The producer keeps its own tail privately and only ever stores it.
+//
+// The other side of the ring is another process and may be buggy or
+// hostile, so nothing read from shared memory is trusted: the capacity is
+// copied when the ring is attached, and a record whose length or position
+// does not fit what the producer has published poisons the ring. A
+// poisoned ring yields nothing more and its channel should be closed.
+class ShmRing {
+public:
+    struct Header {
+        alignas(64) std::atomic<uint64_t> head;  // advanced by the consumer
+        alignas(64) std::atomic<uint64_t> tail;  // advanced by the producer
+        alignas(64) uint64_t capacity;           // size of the data area, a power of two
+    };
+
+    enum : uint32_t {wrapMarker = 0xffffffff};
+
+    ShmRing() = default;
+    // The tail is read once, rounded to a record boundary: from then on the
+    // producer writes only where its own counter says
+    ShmRing(Header* header, char* data, uint64_t capacity)
+        : header(header), data(data), capacity(capacity),
+          producerTail(header->tail.load(std::memory_order_relaxed) & ~static_cast<uint64_t>(7)) {}
+
+    static void initialize(Header* header, uint64_t capacity) {
+        new (&header->head) std::atomic<uint64_t>(0);
+        new (&header->tail) std::atomic<uint64_t>(0);
+        header->capacity = capacity;
+    }
+
+    // Largest payload that is guaranteed to fit
+    size_t maxRecord() const {
+        return capacity / 2 - 4;
+    }
+
+    // Set once a corrupt record was found; the ring is unusable from then on
+    bool poisoned() const { return corrupt; }
+
+    bool tryPush(const char* payload, uint32_t length) {
+        if (length > maxRecord()) return false;
+
+        uint64_t tail = producerTail;
+        size_t needed = padded(length);
+        size_t offset = tail & (capacity - 1);
+        size_t contiguous = capacity - offset;
+        size_t total = contiguous < needed ? contiguous + needed : needed;
+
+        if (tail + total - cachedHead > capacity) {
+            cachedHead = header->head.load(std::memory_order_acquire);
+            if (tail + total - cachedHead > capacity) {
+                return false;
+            }
+        }
+
+        if (contiguous < needed) {
+            uint32_t marker = wrapMarker;
+            std::memcpy(data + offset, &marker, sizeof(marker));
+            tail += contiguous;
+            offset = 0;
+        }
+
+        std::memcpy(data + offset, &length, sizeof(length));
+        std::memcpy(data + offset + sizeof(length), payload, length);
+        producerTail = tail + needed;
+        header->tail.store(producerTail, std::memory_order_release);
+        return true;
+    }
+
+    // Calls consume(const char* payload, uint32_t length) for the next record.
+    // False if the ring is empty or poisoned.
+    template<typename F>
+    bool tryPop(F&& consume) {
+        if (corrupt) {
+            return false;
+        }
+        uint64_t head = header->head.load(std::memory_order_relaxed);
+        if (head == cachedTail) {
+            cachedTail = header->tail.load(std::memory_order_acquire);
+            if (head == cachedTail) {
+                return false;
+            }
+        }
+
+        // Records start 8-byte aligned, and the producer is at most one ring ahead
+        uint64_t available = cachedTail - head;
+        size_t offset = head & (capacity - 1);
+        if (available > capacity || offset % 8 != 0) {
+            return poison();
+        }
+
+        uint32_t length;
+        std::memcpy(&length, data + offset, sizeof(length));
+        if (length == wrapMarker) {
+            // A wrap marker is always followed by the record that did not fit
+            size_t skipped = capacity - offset;
+            if (skipped >= available) {
+                return poison();
+            }
+            head += skipped;
+            available -= skipped;
+            offset = 0;
+            std::memcpy(&length, data, sizeof(length));
+        }
+        // Neither past the published bytes nor past the end of the data area
+        if (length > maxRecord() || padded(length) > available || padded(length) > capacity - offset) {
+            return poison();
+        }
+
+        consume(data + offset + sizeof(length), length);
+        header->head.store(head + padded(length), std::memory_order_release);
+        return true;
+    }
+
+private:
+    static size_t padded(uint32_t length) {
+        return (sizeof(uint32_t) + length + 7) & ~static_cast<size_t>(7);
+    }
+
+    bool poison() {
+        corrupt = true;
+        return false;
+    }
+
+    Header* header = nullptr;
+    char* data = nullptr;
+    uint64_t capacity = 0;    // private copy; the shared one can be overwritten
+    uint64_t producerTail = 0;  // producer side, never read back
+    uint64_t cachedHead = 0;  // producer side
+    uint64_t cachedTail = 0;  // consumer side
+    bool corrupt = false;
+};
+
+// A pair of rings in one POSIX shared memory object: one carrying messages
+// from the client to the server and one carrying them back. The server
+// creates the object (see --shm in server.cpp); a co-located client opens it
+// by name and becomes the single producer of toServer / consumer of toClient.
+class ShmChannel {
+public:
+    enum : uint32_t {magic = 0x42434831};  // "BCH1"
+
+    static std::unique_ptr<ShmChannel> create(const std::string& name, uint64_t capacity) {
+        if (!validCapacity(capacity)) {
+            return nullptr;
+        }
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        size_t size = layoutSize(capacity);
+        if (ftruncate(fd, size) != 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+
+        auto channel = map(fd, size, name, true);
+        if (!channel) {
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+
+        ChannelHeader* header = channel->channelHeader();
+        header->capacity = capacity;
+        ShmRing::initialize(channel->ringHeader(0, capacity), capacity);
+        ShmRing::initialize(channel->ringHeader(1, capacity), capacity);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = magic;
+        channel->attachRings(capacity);
+        return channel;
+    }
+
+    static std::unique_ptr<ShmChannel> open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ChannelHeader)) {
+            ::close(fd);
+            return nullptr;
+        }
+
+        auto channel = map(fd, st.st_size, name, false);
+        if (!channel || channel->channelHeader()->magic != magic) {
+            return nullptr;
+        }
+        // Read once: the mapping is only as large as this capacity says
+        uint64_t capacity = channel->channelHeader()->capacity;
+        if (!validCapacity(capacity) || layoutSize(capacity) != channel->size) {
+            return nullptr;
+        }
+        channel->attachRings(capacity);
+        return channel;
+    }
+
+    ~ShmChannel() {
+        munmap(base, size);
+        if (owner) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    ShmRing& toServer() { return rings[0]; }
+    ShmRing& toClient() { return rings[1]; }
+    const std::string& getName() const { return name; }
+
+    // The owner unlinks the shared memory object when the channel is destroyed
+    void setOwner(bool value) { owner = value; }
+
+private:
+    struct ChannelHeader {
+        alignas(64) uint32_t magic;
+        uint64_t capacity;
+    };
+
+    ShmChannel(void* base, size_t size, std::string name, bool owner)
+        : base(base), size(size), name(std::move(name)), owner(owner) {}
+
+    // A power of two, and room for at least a small record
+    static bool validCapacity(uint64_t capacity) {
+        return capacity >= 64 && (capacity & (capacity - 1)) == 0;
+    }
+
+    static size_t ringBytes(uint64_t capacity) {
+        return sizeof(ShmRing::Header) + capacity;
+    }
+
+    static size_t layoutSize(uint64_t capacity) {
+        return sizeof(ChannelHeader) + 2 * ringBytes(capacity);
+    }
+
+    static std::unique_ptr<ShmChannel> map(int fd, size_t size, const std::string& name, bool owner) {
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return nullptr;
+        }
+        return std::unique_ptr<ShmChannel>(new ShmChannel(base, size, name, owner));
+    }
+
+    ChannelHeader* channelHeader() {
+        return static_cast<ChannelHeader*>(base);
+    }
+
+    ShmRing::Header* ringHeader(int index, uint64_t capacity) {
+        char* start = static_cast<char*>(base) + sizeof(ChannelHeader) + index * ringBytes(capacity);
+        return reinterpret_cast<ShmRing::Header*>(start);
+    }
+
+    void attachRings(uint64_t capacity) {
+        for (int i = 0; i < 2; ++i) {
+            ShmRing::Header* header = ringHeader(i, capacity);
+            rings[i] = ShmRing(header, reinterpret_cast<char*>(header) + sizeof(ShmRing::Header), capacity);
+        }
+    }
+
+    void* base;
+    size_t size;
+    std::string name;
+    bool owner;
+    ShmRing rings[2];
+};
+
+#endif // SHM_RING_HPP
@@ -0,0 +1,172 @@
+#include "shm_ring.hpp"
+#include <iostream>
+#include <string>
+
+// Checks that neither side reads or writes outside the ring, whatever the
+// other side puts in shared memory. Run with `make test`.
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAIL: " << what << "\n";
+        failures++;
+    }
+}
+
+// A ring in ordinary memory, laid out as in a ShmChannel
+struct LocalRing {
+    enum {capacity = 256};
+
+    LocalRing() {
+        header = reinterpret_cast<ShmRing::Header*>(storage);
+        ShmRing::initialize(header, capacity);
+        data = storage + sizeof(ShmRing::Header);
+        producer = ShmRing(header, data, capacity);
+        consumer = ShmRing(header, data, capacity);
+    }
+
+    // Pops one record; "" if nothing was returned
+    std::string pop() {
+        std::string payload;
+        consumer.tryPop([&](const char* bytes, uint32_t length) { payload.assign(bytes, length); });
+        return payload;
+    }
+
+    alignas(64) char storage[sizeof(ShmRing::Header) + capacity];
+    char guard[64] = {};  // right behind the data area; must stay untouched
+    ShmRing::Header* header;
+    char* data;
+    ShmRing producer;
+    ShmRing consumer;
+};
+
+void testRoundTrip() {
+    LocalRing ring;
+    // Enough records to wrap around the end of the data area several times
+    for (int i = 0; i < 100; ++i) {
+        std::string message = "message " + std::to_string(i);
+        check(ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size())), "push " + message);
+        check(ring.pop() == message, "pop " + message);
+    }
+    check(!ring.consumer.poisoned(), "valid records do not poison the ring");
+}
+
+void testLengthBeyondRecordLimit() {
+    LocalRing ring;
+    std::string message = "hello";
+    ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size()));
+
+    // The producer rewrites the length header to point far past the ring
+    uint32_t length = 1u << 30;
+    std::memcpy(ring.data, &length, sizeof(length));
+
+    bool consumed = false;
+    check(!ring.consumer.tryPop([&](const char*, uint32_t) { consumed = true; }), "oversized record is refused");
+    check(!consumed, "oversized record is not handed out");
+    check(ring.consumer.poisoned(), "oversized record poisons the ring");
+
+    // Nothing more comes out, even once valid records follow
+    ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size()));
+    check(ring.pop().empty(), "poisoned ring yields nothing");
+}
+
+void testLengthBeyondPublishedBytes() {
+    LocalRing ring;
+    std::string message = "hello";
+    ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size()));
+
+    // Within maxRecord, but longer than what the producer published
+    uint32_t length = 64;
+    std::memcpy(ring.data, &length, sizeof(length));
+    check(ring.pop().empty(), "record longer than the published bytes is refused");
+    check(ring.consumer.poisoned(), "record longer than the published bytes poisons the ring");
+}
+
+void testLengthBeyondDataArea() {
+    LocalRing ring;
+    // Records of 116 and 120 bytes leave the head 8 bytes before the end
+    for (uint32_t size : {116u, 120u}) {
+        std::string message(size, 'x');
+        ring.producer.tryPush(message.data(), size);
+        ring.pop();
+    }
+    std::string small = "abcd";
+    ring.producer.tryPush(small.data(), static_cast<uint32_t>(small.size()));
+    std::string next(100, 'y');
+    ring.producer.tryPush(next.data(), static_cast<uint32_t>(next.size()));
+
+    // Fits in the published bytes, but not in the 8 bytes before the wrap
+    uint32_t length = 100;
+    std::memcpy(ring.data + 248, &length, sizeof(length));
+    check(ring.pop().empty(), "record past the end of the data area is refused");
+    check(ring.consumer.poisoned(), "record past the end of the data area poisons the ring");
+}
+
+void testTamperedProducerTail() {
+    LocalRing ring;
+    std::string message = "hello";
+    ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size()));
+
+    // The peer moves the producer's tail to an unaligned offset near the end
+    ring.header->tail.store(LocalRing::capacity - 2);
+    std::string next(100, 'y');
+    check(ring.producer.tryPush(next.data(), static_cast<uint32_t>(next.size())), "push after tampered tail");
+    bool untouched = true;
+    for (char c : ring.guard) {
+        untouched = untouched && c == 0;
+    }
+    check(untouched, "producer does not write past the data area");
+    check(ring.pop() == message && ring.pop() == next, "producer continues from its own tail");
+}
+
+void testTailTooFarAhead() {
+    LocalRing ring;
+    ring.header->tail.store(LocalRing::capacity * 4);
+    check(ring.pop().empty(), "tail more than a ring ahead is refused");
+    check(ring.consumer.poisoned(), "tail more than a ring ahead poisons the ring");
+}
+
+void testWrapMarkerWithoutRecord() {
+    LocalRing ring;
+    std::string message = "hello";
+    ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size()));
+
+    // A wrap marker at the head, with only the published bytes behind it
+    uint32_t marker = ShmRing::wrapMarker;
+    std::memcpy(ring.data, &marker, sizeof(marker));
+    check(ring.pop().empty(), "wrap marker not followed by a record is refused");
+    check(ring.consumer.poisoned(), "wrap marker not followed by a record poisons the ring");
+}
+
+void testOverwrittenCapacity() {
+    LocalRing ring;
+    // The shared capacity is ignored once the ring is attached
+    ring.header->capacity = 1ull << 40;
+    std::string message(200, 'x');
+    check(!ring.producer.tryPush(message.data(), static_cast<uint32_t>(message.size())),
+          "record over the attached capacity's limit is not pushed");
+    check(ring.consumer.maxRecord() == LocalRing::capacity / 2 - 4, "capacity is the one the ring was attached with");
+}
+
+} // namespace
+
+int main() {
+    testRoundTrip();
+    testLengthBeyondRecordLimit();
+    testLengthBeyondPublishedBytes();
+    testLengthBeyondDataArea();
+    testTamperedProducerTail();
+    testTailTooFarAhead();
+    testWrapMarkerWithoutRecord();
+    testOverwrittenCapacity();
+
+    if (failures > 0) {
+        std::cerr << failures << " shm ring checks failed\n";
+        return 1;
+    }
+    std::cout << "shm ring: all checks passed\n";
+    return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Start a local cluster of chatApp nodes linked over Unix sockets
+# Usage: ./start_cluster.sh <nodes> <first_client_port>
+
+NODES=${1:-3}
+BASE_PORT=${2:-9100}
+SOCKET_DIR=${SOCKET_DIR:-/tmp/bytechat-cluster}
+
+mkdir -p "$SOCKET_DIR"
+
+# Each node dials every node started before it, giving a full mesh
+for ((i = 0; i < NODES; i++)); do
+    mkdir -p "$SOCKET_DIR/node$i"
+    ARGS="--cluster-id node$i --cluster-listen unix:$SOCKET_DIR/node$i.sock"
+    for ((j = 0; j < i; j++)); do
+        ARGS="$ARGS --cluster-peer unix:$SOCKET_DIR/node$j.sock"
+    done
+
+    # Run each node in its own directory so their chat_server.log files stay separate
+    (cd "$SOCKET_DIR/node$i" && exec "$OLDPWD/chatApp" $((BASE_PORT + i)) $ARGS > /dev/null 2>&1) &
+    echo "node$i: client port $((BASE_PORT + i)), log $SOCKET_DIR/node$i/chat_server.log"
+    sleep 0.2
+done
@@ -0,0 +1,203 @@
+#ifndef TRAFFIC_TRACE_HPP
+#define TRAFFIC_TRACE_HPP
+
+#include "logger.hpp"
+#include "wire.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+// Traffic traces: the ingress timeline of a running server, recorded with
+// --capture <file> and replayed against a local server by replayApp.
+//
+// Only the shape of the traffic is kept (when clients connect, send and
+// disconnect, and how large each message is), never message contents.
+//
+//     file     "CHTRACE1" | u64 capture start, ns since the Unix epoch | records
+//     record   u8 type | varint connection | varint us since the previous record
+//              | varint bytes (MESSAGE only)
+//
+// Connections are numbered from 0 in the order they connect. Varints and
+// time deltas keep a typical record at 4-6 bytes.
+
+struct TraceEvent {
+    enum Type : uint8_t { CONNECT = 1, MESSAGE = 2, DISCONNECT = 3 };
+
+    Type type;
+    uint64_t connection;
+    uint64_t timeUs;   // since the start of the capture
+    uint64_t bytes;
+};
+
+static constexpr char traceMagic[] = "CHTRACE1";
+
+// Reads a whole trace into memory and hands out its events in order
+class TraceReader {
+public:
+    bool open(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        data = contents.str();
+        if (data.size() < 16 || data.compare(0, 8, traceMagic) != 0) {
+            return false;
+        }
+        startNs = readLE(data.data() + 8, 8);
+        reader = std::make_unique<WireReader>(data.data() + 16, data.size() - 16);
+        return true;
+    }
+
+    // False at the end of the trace, or at a record cut short by a crash
+    bool next(TraceEvent& event) {
+        if (!reader || reader->atEnd()) {
+            return false;
+        }
+        event.type = static_cast<TraceEvent::Type>(reader->readInt(1));
+        event.connection = reader->readVarint();
+        timeUs += reader->readVarint();
+        event.timeUs = timeUs;
+        event.bytes = event.type == TraceEvent::MESSAGE ? reader->readVarint() : 0;
+        return reader->ok();
+    }
+
+    uint64_t captureStartNs() const { return startNs; }
+
+private:
+    std::string data;
+    std::unique_ptr<WireReader> reader;
+    uint64_t startNs = 0;
+    uint64_t timeUs = 0;
+};
+
+// Records the server's ingress; every call is a no-op unless a capture runs
+class TrafficCapture {
+public:
+    static constexpr uint64_t noConnection = UINT64_MAX;
+
+    static TrafficCapture& getInstance() {
+        static TrafficCapture instance;
+        return instance;
+    }
+
+    bool start(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mtx);
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            LOG_ERROR("Cannot open capture file %s", path.c_str());
+            return false;
+        }
+        start_ = std::chrono::steady_clock::now();
+        lastRecordUs = 0;
+        lastFlush = start_;
+        buffer.assign(traceMagic, 8);
+        appendU64(buffer, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        active.store(true, std::memory_order_release);
+        LOG_INFO("Capturing client traffic to %s", path.c_str());
+        return true;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!active.load(std::memory_order_relaxed)) {
+            return;
+        }
+        active.store(false, std::memory_order_release);
+        flushLocked();
+        std::fclose(file);
+        file = nullptr;
+        LOG_INFO("Traffic capture finished: %llu connections, %llu messages",
+                 static_cast<unsigned long long>(connections), static_cast<unsigned long long>(messages));
+    }
+
+    bool capturing() const { return active.load(std::memory_order_relaxed); }
+
+    // Number for a new connection, or noConnection if nothing is captured
+    uint64_t connect() {
+        if (!capturing()) {
+            return noConnection;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        uint64_t connection = connections++;
+        record(TraceEvent::CONNECT, connection, 0);
+        return connection;
+    }
+
+    void message(uint64_t connection, size_t bytes) {
+        if (connection == noConnection || !capturing()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        messages++;
+        record(TraceEvent::MESSAGE, connection, bytes);
+    }
+
+    void disconnect(uint64_t connection) {
+        if (connection == noConnection || !capturing()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        record(TraceEvent::DISCONNECT, connection, 0);
+    }
+
+    ~TrafficCapture() {
+        stop();
+    }
+
+private:
+    TrafficCapture() = default;
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    enum {flushBytes = 64 * 1024};
+
+    // Called with mtx held
+    void record(TraceEvent::Type type, uint64_t connection, size_t bytes) {
+        if (!file) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        uint64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(now - start_).count();
+        buffer.push_back(static_cast<char>(type));
+        appendVarint(buffer, connection);
+        appendVarint(buffer, nowUs - lastRecordUs);
+        if (type == TraceEvent::MESSAGE) {
+            appendVarint(buffer, bytes);
+        }
+        lastRecordUs = nowUs;
+
+        // Written out in blocks, and at least every second so a killed server loses little
+        if (buffer.size() >= flushBytes || now - lastFlush >= std::chrono::seconds(1)) {
+            flushLocked();
+            lastFlush = now;
+        }
+    }
+
+    void flushLocked() {
+        if (file && !buffer.empty()) {
+            std::fwrite(buffer.data(), 1, buffer.size(), file);
+            std::fflush(file);
+            buffer.clear();
+        }
+    }
+
+    std::mutex mtx;
+    std::atomic<bool> active{false};
+    std::FILE* file = nullptr;
+    std::string buffer;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point lastFlush;
+    uint64_t lastRecordUs = 0;
+    uint64_t connections = 0;
+    uint64_t messages = 0;
+};
+
+#endif // TRAFFIC_TRACE_HPP
@@ -0,0 +1,512 @@
+#include "uring_loop.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// Multishot accept and provided buffer rings arrived together (Linux 5.19)
+#if defined(IORING_ACCEPT_MULTISHOT) && defined(__NR_io_uring_setup)
+
+namespace {
+
+int ringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ringRegister(int fd, unsigned opcode, void* arg, unsigned args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, args));
+}
+
+std::string errorText(const std::string& what, int error) {
+    return what + ": " + std::strerror(error);
+}
+
+} // namespace
+
+UringLoop::UringLoop(boost::asio::io_context& l): loop(l) {}
+
+std::unique_ptr<UringLoop> UringLoop::create(boost::asio::io_context& loop, std::string& reason) {
+    std::unique_ptr<UringLoop> ring(new UringLoop(loop));
+    if (!ring->setUp(reason) || !ring->selfTest(reason)) {
+        return nullptr;
+    }
+    ring->watch();
+    return ring;
+}
+
+bool UringLoop::setUp(std::string& reason) {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+    // Room for a completion per connection and a few more before overflowing
+    params.cq_entries = ringEntries * 4;
+    ringFd = static_cast<int>(::syscall(__NR_io_uring_setup, ringEntries, &params));
+    if (ringFd < 0) {
+        reason = errorText("io_uring_setup", errno);
+        return false;
+    }
+    // From here on the descriptor belongs to the watcher, which closes it
+    watcher = std::make_unique<boost::asio::posix::stream_descriptor>(loop, ringFd);
+
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    if ((params.features & required) != required) {
+        reason = "kernel io_uring lacks single mmap, no-drop or fast poll support";
+        return false;
+    }
+
+    ringMapSize = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                   params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ringMap = ::mmap(nullptr, ringMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ringFd, IORING_OFF_SQ_RING);
+    entryMapSize = params.sq_entries * sizeof(io_uring_sqe);
+    entryMap = ::mmap(nullptr, entryMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd, IORING_OFF_SQES);
+    if (ringMap == MAP_FAILED || entryMap == MAP_FAILED) {
+        reason = errorText("mapping the io_uring queues", errno);
+        ringMap = ringMap == MAP_FAILED ? nullptr : ringMap;
+        entryMap = entryMap == MAP_FAILED ? nullptr : entryMap;
+        return false;
+    }
+
+    char* base = static_cast<char*>(ringMap);
+    sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sqFlags = reinterpret_cast<unsigned*>(base + params.sq_off.flags);
+    sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    queuedTail = *sqTail;
+    // Submission slots map one to one onto entries
+    unsigned* sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; ++i) {
+        sqArray[i] = i;
+    }
+    cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = base + params.cq_off.cqes;
+
+    // Every operation used here must be known to the kernel
+    std::vector<char> probeMemory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto* probe = reinterpret_cast<io_uring_probe*>(probeMemory.data());
+    if (ringRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        reason = errorText("probing io_uring operations", errno);
+        return false;
+    }
+    const std::pair<int, const char*> needed[] = {
+        {IORING_OP_ACCEPT, "accept"}, {IORING_OP_RECV, "recv"},
+        {IORING_OP_SENDMSG, "sendmsg"}, {IORING_OP_ASYNC_CANCEL, "cancel"}
+    };
+    for (const auto& op : needed) {
+        if (op.first > probe->last_op || !(probe->ops[op.first].flags & IO_URING_OP_SUPPORTED)) {
+            reason = std::string("kernel io_uring has no ") + op.second + " operation";
+            return false;
+        }
+    }
+
+    // The provided buffers and the ring the kernel picks them from
+    bufferRing = ::mmap(nullptr, bufferCount * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* memory = ::mmap(nullptr, static_cast<size_t>(bufferCount) * bufferSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED || memory == MAP_FAILED) {
+        reason = errorText("allocating receive buffers", errno);
+        bufferRing = bufferRing == MAP_FAILED ? nullptr : bufferRing;
+        bufferMemory = memory == MAP_FAILED ? nullptr : static_cast<char*>(memory);
+        return false;
+    }
+    bufferMemory = static_cast<char*>(memory);
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    registration.ring_entries = bufferCount;
+    registration.bgid = bufferGroup;
+    if (ringRegister(ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        reason = errorText("registering provided buffers", errno);
+        return false;
+    }
+    for (unsigned i = 0; i < bufferCount; ++i) {
+        recycle(static_cast<uint16_t>(i));
+    }
+    return true;
+}
+
+bool UringLoop::selfTest(std::string& reason) {
+    // Nothing is left for the loop to run should the ring be thrown away; runUntil submits
+    roundScheduled = true;
+    // A listener in the abstract namespace; binding just the family picks a free name
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    socklen_t length = sizeof(address);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(sa_family_t)) != 0 ||
+        ::listen(listener, 4) != 0 ||
+        ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        reason = errorText("self-test listener", errno);
+        if (listener >= 0) ::close(listener);
+        return false;
+    }
+
+    int result = 0;
+    int accepted = -1;
+    bool more = false;
+    bool done = false;
+    OpId acceptOp = accept(listener, [&](int r, const char*, bool m) {
+        if (!done) {
+            result = r;
+            accepted = r;
+            more = m;
+            done = true;
+        } else if (r >= 0) {
+            ::close(r);
+        }
+    });
+    int client = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool ok = client >= 0 && ::connect(client, reinterpret_cast<sockaddr*>(&address), length) == 0 &&
+              runUntil(done) && result >= 0 && more;
+    if (!ok) {
+        reason = result < 0 ? errorText("multishot accept", -result) : "multishot accept is not supported";
+    }
+    if (done && more) {
+        cancelAndWait(acceptOp);
+    }
+
+    if (ok) {
+        done = false;
+        std::string received;
+        receive(accepted, bufferSize, [&](int r, const char* data, bool) {
+            result = r;
+            if (r > 0) {
+                received.assign(data, r);
+            }
+            done = true;
+        });
+        ok = ::send(client, "ping", 4, MSG_NOSIGNAL) == 4 && runUntil(done) && received == "ping";
+        if (!ok) {
+            reason = result < 0 ? errorText("receive into provided buffers", -result)
+                                : "receive into provided buffers returned no data";
+        }
+    }
+
+    for (int fd : {client, accepted, listener}) {
+        if (fd >= 0) ::close(fd);
+    }
+    roundScheduled = false;
+    return ok;
+}
+
+bool UringLoop::runUntil(const bool& done) {
+    while (!done) {
+        submit();
+        pollfd ready{ringFd, POLLIN, 0};
+        if (::poll(&ready, 1, 1000) <= 0) {
+            return false;
+        }
+        reap();
+    }
+    return true;
+}
+
+UringLoop::~UringLoop() {
+    // Requests still running read or write memory that is about to go away
+    bool drained = ops.empty();
+    roundScheduled = true;
+    if (!drained && entryMap) {
+        auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+        entry->opcode = IORING_OP_ASYNC_CANCEL;
+        entry->fd = -1;
+        entry->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        entry->user_data = cancelTag;
+        submit();
+
+        // Completions are only counted off here; no handler runs any more
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!ops.empty() && std::chrono::steady_clock::now() < deadline) {
+            for (const auto& completion : backlog) {
+                if (!(completion.flags & IORING_CQE_F_MORE)) ops.erase(completion.userData);
+            }
+            backlog.clear();
+            Completion completion;
+            while (nextCompletion(completion)) {
+                if (!(completion.flags & IORING_CQE_F_MORE)) ops.erase(completion.userData);
+            }
+            pollfd ready{ringFd, POLLIN, 0};
+            ::poll(&ready, 1, 10);
+        }
+        drained = ops.empty();
+        if (!drained) {
+            LOG_WARNING("io_uring: %zu requests did not stop; leaving their buffers mapped", ops.size());
+        }
+    }
+    ops.clear();
+    watcher.reset();
+
+    if (ringMap) ::munmap(ringMap, ringMapSize);
+    if (entryMap) ::munmap(entryMap, entryMapSize);
+    if (drained) {
+        if (bufferRing) ::munmap(bufferRing, bufferCount * sizeof(io_uring_buf));
+        if (bufferMemory) ::munmap(bufferMemory, static_cast<size_t>(bufferCount) * bufferSize);
+    }
+}
+
+UringLoop::OpId UringLoop::accept(int fd, Handler handler) {
+    OpId id = nextId++;
+    Op& op = ops[id];
+    op.kind = ACCEPT;
+    op.fd = fd;
+    op.handler = std::move(handler);
+
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    entry->opcode = IORING_OP_ACCEPT;
+    entry->fd = fd;
+    entry->ioprio = IORING_ACCEPT_MULTISHOT;
+    entry->accept_flags = SOCK_CLOEXEC;
+    entry->user_data = id;
+    return id;
+}
+
+UringLoop::OpId UringLoop::receive(int fd, size_t maxBytes, Handler handler) {
+    OpId id = nextId++;
+    Op& op = ops[id];
+    op.kind = RECEIVE;
+    op.fd = fd;
+    op.maxBytes = std::min<size_t>(maxBytes, bufferSize);
+    op.handler = std::move(handler);
+    prepareReceive(id, op);
+    return id;
+}
+
+void UringLoop::prepareReceive(OpId id, const Op& op) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    entry->opcode = IORING_OP_RECV;
+    entry->fd = op.fd;
+    entry->len = static_cast<uint32_t>(op.maxBytes);
+    entry->flags = IOSQE_BUFFER_SELECT;
+    entry->buf_group = bufferGroup;
+    entry->user_data = id;
+}
+
+UringLoop::OpId UringLoop::send(int fd, const std::vector<boost::asio::const_buffer>& buffers, Handler handler) {
+    OpId id = nextId++;
+    Op& op = ops[id];
+    op.kind = SEND;
+    op.fd = fd;
+    op.handler = std::move(handler);
+    op.iov.reserve(buffers.size());
+    for (const auto& buffer : buffers) {
+        op.iov.push_back(iovec{const_cast<void*>(buffer.data()), buffer.size()});
+    }
+    // Nodes of an unordered_map stay put, so the kernel can keep pointing at these
+    op.message.msg_iov = op.iov.data();
+    op.message.msg_iovlen = op.iov.size();
+
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    entry->opcode = IORING_OP_SENDMSG;
+    entry->fd = fd;
+    entry->addr = reinterpret_cast<uint64_t>(&op.message);
+    entry->len = 1;
+    entry->msg_flags = MSG_NOSIGNAL;
+    entry->user_data = id;
+    return id;
+}
+
+void UringLoop::cancel(OpId id) {
+    auto it = ops.find(id);
+    if (it == ops.end() || it->second.cancelling) {
+        return;
+    }
+    it->second.cancelling = true;
+
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    entry->opcode = IORING_OP_ASYNC_CANCEL;
+    entry->fd = -1;
+    entry->addr = id;
+    entry->user_data = cancelTag;
+}
+
+void UringLoop::cancelAndWait(OpId id) {
+    if (!ops.count(id)) {
+        return;
+    }
+    cancel(id);
+    submit();
+
+    while (ops.count(id)) {
+        Completion completion;
+        if (!nextCompletion(completion)) {
+            if (ringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                LOG_ERROR("io_uring: waiting for a cancelled request: %s", std::strerror(errno));
+                return;
+            }
+            continue;
+        }
+        if (completion.userData == id) {
+            dispatch(completion);
+        } else if (completion.userData != cancelTag) {
+            backlog.push_back(completion);
+        }
+    }
+    if (!backlog.empty()) {
+        scheduleRound();
+    }
+}
+
+void* UringLoop::nextEntry() {
+    // Full: hand what is queued to the kernel now rather than at the end of the round
+    if (queuedTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        submit();
+    }
+    auto* entry = &static_cast<io_uring_sqe*>(entryMap)[queuedTail & sqMask];
+    std::memset(entry, 0, sizeof(*entry));
+    queuedTail++;
+    scheduleRound();
+    return entry;
+}
+
+void UringLoop::scheduleRound() {
+    if (roundScheduled) {
+        return;
+    }
+    roundScheduled = true;
+    boost::asio::post(loop, [this]() {
+        roundScheduled = false;
+        submit();
+        // Sends that went out right away have completed already
+        reap();
+    });
+}
+
+void UringLoop::submit() {
+    __atomic_store_n(sqTail, queuedTail, __ATOMIC_RELEASE);
+    unsigned pending = queuedTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (pending == 0) {
+        return;
+    }
+
+    int submitted = ringEnter(ringFd, pending, 0, 0);
+    // Busy: completions have to be made room for first
+    if (submitted < 0 && (errno == EAGAIN || errno == EBUSY)) {
+        submitted = ringEnter(ringFd, pending, 0, IORING_ENTER_GETEVENTS);
+    }
+    if (submitted < 0 && errno != EINTR) {
+        LOG_ERROR("io_uring: submitting %u requests failed: %s", pending, std::strerror(errno));
+        return;
+    }
+    if (submitted > 0) {
+        MetricsCollector::getInstance().recordMetric("uring_submit_batch", submitted);
+    }
+}
+
+void UringLoop::watch() {
+    watcher->async_wait(boost::asio::posix::stream_descriptor::wait_read,
+        [this](const boost::system::error_code& ec) {
+            if (ec) {
+                return;
+            }
+            reap();
+            watch();
+        });
+}
+
+bool UringLoop::nextCompletion(Completion& completion) {
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        // Completions that found the queue full wait in the kernel until asked for
+        if (!(__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) ||
+            ringEnter(ringFd, 0, 0, IORING_ENTER_GETEVENTS) < 0 ||
+            head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+    }
+    const io_uring_cqe& cqe = static_cast<const io_uring_cqe*>(cqes)[head & cqMask];
+    completion = Completion{cqe.user_data, cqe.res, cqe.flags};
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void UringLoop::reap() {
+    // Completions held back by cancelAndWait come first
+    while (!backlog.empty()) {
+        Completion completion = backlog.front();
+        backlog.pop_front();
+        dispatch(completion);
+    }
+    Completion completion;
+    while (nextCompletion(completion)) {
+        dispatch(completion);
+    }
+}
+
+void UringLoop::dispatch(const Completion& completion) {
+    const char* data = nullptr;
+    uint16_t buffer = 0;
+    if (completion.flags & IORING_CQE_F_BUFFER) {
+        buffer = static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+        data = bufferMemory + static_cast<size_t>(buffer) * bufferSize;
+    }
+
+    auto it = ops.find(completion.userData);
+    if (completion.userData == cancelTag || it == ops.end()) {
+        if (data) recycle(buffer);
+        return;
+    }
+
+    // No provided buffer was free; by now earlier handlers have given theirs back
+    if (completion.result == -ENOBUFS && it->second.kind == RECEIVE && !it->second.cancelling) {
+        MetricsCollector::getInstance().recordMetric("uring_buffer_exhausted", 1);
+        prepareReceive(it->first, it->second);
+        return;
+    }
+
+    // The handler may queue new requests, and rehashing keeps elements where they are,
+    // but it must not be the one erased while it runs
+    bool more = completion.flags & IORING_CQE_F_MORE;
+    Handler handler = more ? it->second.handler : std::move(it->second.handler);
+    if (!more) {
+        ops.erase(it);
+    }
+    handler(completion.result, data, more);
+    if (data) {
+        recycle(buffer);
+    }
+}
+
+void UringLoop::recycle(uint16_t buffer) {
+    // io_uring_buf_ring::bufs is not at offset 0 when compiled as C++ (its
+    // flexible array sits behind an empty struct), so the entries are addressed
+    // directly. The ring's tail is the first entry's resv field.
+    auto* entries = static_cast<io_uring_buf*>(bufferRing);
+    io_uring_buf& entry = entries[bufferTail & (bufferCount - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(bufferMemory + static_cast<size_t>(buffer) * bufferSize);
+    entry.len = bufferSize;
+    entry.bid = buffer;
+    bufferTail++;
+    __atomic_store_n(&entries[0].resv, bufferTail, __ATOMIC_RELEASE);
+}
+
+#else
+
+// Kernel headers older than Linux 5.19: always served by epoll
+
+UringLoop::UringLoop(boost::asio::io_context& l): loop(l) {}
+UringLoop::~UringLoop() = default;
+
+std::unique_ptr<UringLoop> UringLoop::create(boost::asio::io_context&, std::string& reason) {
+    reason = "built against kernel headers without multishot accept";
+    return nullptr;
+}
+
+UringLoop::OpId UringLoop::accept(int, Handler) { return 0; }
+UringLoop::OpId UringLoop::receive(int, size_t, Handler) { return 0; }
+UringLoop::OpId UringLoop::send(int, const std::vector<boost::asio::const_buffer>&, Handler) { return 0; }
+void UringLoop::cancel(OpId) {}
+void UringLoop::cancelAndWait(OpId) {}
+
+#endif
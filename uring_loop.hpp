@@ -0,0 +1,141 @@
+#ifndef URING_LOOP_HPP
+#define URING_LOOP_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Socket I/O through io_uring, driven from an asio event loop.
+//
+// Boost 1.74's asio has no io_uring support and liburing is not a
+// dependency, so the ring is set up with the raw system calls. It serves
+// the sockets of the main event loop (see io_backend.hpp):
+//
+//     accept   one multishot accept per listener; every new connection
+//              arrives as another completion of the same request
+//     receive  recv that picks one of bufferCount provided buffers, so no
+//              memory is tied up per idle connection. One-shot: a multishot
+//              recv cannot be capped at the space left in a session's
+//              input budget.
+//     send     sendmsg gathering a session's queued output
+//
+// Submissions are batched: the first request queued while handlers run
+// schedules one io_uring_enter for everything queued until the loop gets to
+// it, so a broadcast to N sessions costs one system call instead of N.
+// The ring's descriptor is watched by the loop's reactor and completions
+// are handled on the loop's thread like any other asio handler.
+
+class UringLoop {
+    public:
+        typedef uint64_t OpId;
+        // result: bytes or a new descriptor, or -errno. data: the received
+        // bytes, valid during the call. more: further completions follow.
+        typedef std::function<void(int result, const char* data, bool more)> Handler;
+
+        // A ring for loop; nullptr, with reason set, if the kernel (or a
+        // sandbox) does not offer everything used here
+        static std::unique_ptr<UringLoop> create(boost::asio::io_context& loop, std::string& reason);
+        ~UringLoop();
+
+        OpId accept(int fd, Handler handler);
+        OpId receive(int fd, size_t maxBytes, Handler handler);
+        // The buffers must stay valid until the handler runs
+        OpId send(int fd, const std::vector<boost::asio::const_buffer>& buffers, Handler handler);
+
+        // Asks the kernel to stop op; its handler still runs for the last
+        // completion, with -ECANCELED unless op had finished anyway
+        void cancel(OpId op);
+        // Returns once op's handler has run for the last time. Completions of
+        // other requests that arrive meanwhile wait until the loop gets to them.
+        void cancelAndWait(OpId op);
+
+        boost::asio::io_context& context() { return loop; }
+
+        static boost::system::error_code errorCode(int result) {
+            return result < 0 ? boost::system::error_code(-result, boost::system::system_category())
+                              : boost::system::error_code();
+        }
+
+    private:
+        enum {ringEntries = 4096};
+        enum {bufferCount = 256};     // a power of two
+        enum {bufferSize = 16384};
+        enum {bufferGroup = 0};
+        // user_data of cancel requests, whose own completions are ignored
+        static constexpr OpId cancelTag = 0;
+
+        enum Kind {ACCEPT, RECEIVE, SEND};
+        struct Op {
+            Kind kind;
+            int fd;
+            size_t maxBytes = 0;
+            bool cancelling = false;
+            Handler handler;
+            std::vector<iovec> iov;
+            msghdr message{};
+        };
+        struct Completion {
+            uint64_t userData;
+            int32_t result;
+            uint32_t flags;
+        };
+
+        explicit UringLoop(boost::asio::io_context& loop);
+        bool setUp(std::string& reason);
+        // Runs an accept and a receive to see the kernel supports both as used here
+        bool selfTest(std::string& reason);
+        // Handles completions until done is set; false after a second without any
+        bool runUntil(const bool& done);
+
+        // The next free submission queue entry, zeroed
+        void* nextEntry();
+        void prepareReceive(OpId id, const Op& op);
+        // Submits and reaps once the loop is done with the handlers running now
+        void scheduleRound();
+        void submit();
+        void watch();
+        bool nextCompletion(Completion& completion);
+        void reap();
+        void dispatch(const Completion& completion);
+        // Gives a provided buffer back to the kernel
+        void recycle(uint16_t buffer);
+
+        boost::asio::io_context& loop;
+        int ringFd = -1;
+        std::unique_ptr<boost::asio::posix::stream_descriptor> watcher;
+        bool roundScheduled = false;
+
+        void* ringMap = nullptr;
+        size_t ringMapSize = 0;
+        void* entryMap = nullptr;
+        size_t entryMapSize = 0;
+        unsigned* sqHead = nullptr;
+        unsigned* sqTail = nullptr;
+        unsigned* sqFlags = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned queuedTail = 0;   // entries up to here are filled in
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned cqMask = 0;
+        void* cqes = nullptr;
+
+        void* bufferRing = nullptr;
+        char* bufferMemory = nullptr;
+        uint16_t bufferTail = 0;
+
+        OpId nextId = 1;
+        std::unordered_map<OpId, Op> ops;
+        std::deque<Completion> backlog;
+};
+
+#endif // URING_LOOP_HPP
@@ -0,0 +1,103 @@
+#ifndef WIRE_HPP
+#define WIRE_HPP
+
+#include <cstdint>
+#include <string>
+
+// Little-endian encoding helpers shared by the binary protocols (cluster
+// links, hot-restart handover, traffic traces)
+
+inline void appendU16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value & 0xff));
+    out.push_back(static_cast<char>((value >> 8) & 0xff));
+}
+
+inline void appendU32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+inline void appendU64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+// 7 bits per byte, least significant first; the high bit marks a continuation
+inline void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// u32 length followed by the bytes
+inline void appendString(std::string& out, const std::string& value) {
+    appendU32(out, static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+inline uint64_t readLE(const char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Bounds-checked sequential reader; once a read runs past the end every
+// further read returns zero/empty and ok() reports false
+class WireReader {
+public:
+    WireReader(const char* data, size_t length) : data(data), length(length) {}
+
+    uint64_t readInt(int bytes) {
+        if (!valid || length - offset < static_cast<size_t>(bytes)) {
+            valid = false;
+            return 0;
+        }
+        uint64_t value = readLE(data + offset, bytes);
+        offset += bytes;
+        return value;
+    }
+
+    uint64_t readVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint64_t byte = readInt(1);
+            if (!valid) {
+                return 0;
+            }
+            value |= (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        valid = false;
+        return 0;
+    }
+
+    std::string readString() {
+        size_t size = readInt(4);
+        if (!valid || length - offset < size) {
+            valid = false;
+            return std::string();
+        }
+        std::string value(data + offset, size);
+        offset += size;
+        return value;
+    }
+
+    bool ok() const { return valid; }
+    bool atEnd() const { return offset == length; }
+
+private:
+    const char* data;
+    size_t length;
+    size_t offset = 0;
+    bool valid = true;
+};
+
+#endif // WIRE_HPP